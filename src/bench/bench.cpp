@@ -0,0 +1,488 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include "../ormcpp/ormcpp.h"
+using namespace std;
+
+/*
+* 性能测试，每项结果输出一行json，方便和其他提交的结果比较
+* bench [--host 127.0.0.1] [--port 3306] [--user root] [--password ""] [--database test]
+*       [--rows 10000] [--filter 名字中包含的字符串] [--no-db] [--memory]
+* --no-db时只运行不需要数据库的项目(sql生成、反射、连接池、bulk_writer检查)
+* --memory时insert和query在memory_db上运行，只有ORM自身的开销
+* 会在database中创建并清空bench_narrow和bench_wide两张表
+*/
+
+struct narrow {
+	DEFINE_TABLE(bench_narrow, id, name, age);
+
+	int id;
+	std::string name;
+	int age;
+};
+
+struct wide {
+	DEFINE_TABLE(bench_wide, id, a, b, c, d, e, s1, s2, s3, s4, s5, note);
+
+	int id;
+	int a;
+	int64_t b;
+	double c;
+	double d;
+	int e;
+	std::string s1;
+	std::string s2;
+	std::string s3;
+	std::string s4;
+	std::string s5;
+	std::optional<std::string> note;
+};
+
+struct options {
+	const char* host{ "127.0.0.1" };
+	const char* user{ "root" };
+	const char* password{ "" };
+	const char* database{ "test" };
+	int port{ 3306 };
+	size_t rows{ 10000 };
+	std::string filter;
+	bool no_db{ false };
+	bool memory{ false };
+};
+
+static options opt;
+
+using bench_clock = std::chrono::steady_clock;
+
+//items是每次迭代处理的行数，用来计算吞吐量
+static void report(const std::string& group, const std::string& name, size_t iterations,
+	double seconds, size_t items, bool ok = true) {
+	double ns = iterations == 0 ? 0 : seconds * 1e9 / iterations;
+	double per_sec = seconds > 0 ? iterations * items / seconds : 0;
+	printf("{\"group\":\"%s\",\"name\":\"%s\",\"iterations\":%zu,\"seconds\":%.6f,"
+		"\"ns_per_op\":%.1f,\"items_per_op\":%zu,\"items_per_sec\":%.1f,\"ok\":%s}\n",
+		group.c_str(), name.c_str(), iterations, seconds, ns, items, per_sec, ok ? "true" : "false");
+	fflush(stdout);
+}
+
+static bool selected(const std::string& group, const std::string& name) {
+	return opt.filter.empty() || (group + "/" + name).find(opt.filter) != std::string::npos;
+}
+
+//不访问数据库的项目，迭代次数翻倍直到运行时间超过0.5秒
+template<typename F>
+static void run_cpu(const std::string& group, const std::string& name, size_t items, F&& f) {
+	if (!selected(group, name)) {
+		return;
+	}
+
+	size_t iterations = 1;
+	while (true) {
+		auto start = bench_clock::now();
+		for (size_t i = 0; i < iterations; i++) {
+			f();
+		}
+		double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+		if (seconds >= 0.5 || iterations >= (size_t(1) << 30)) {
+			report(group, name, iterations, seconds, items);
+			return;
+		}
+		iterations *= 2;
+	}
+}
+
+//访问数据库的项目只跑固定的次数，f返回是否成功
+template<typename F>
+static void run_db(const std::string& group, const std::string& name, size_t iterations, size_t items, F&& f) {
+	if (!selected(group, name)) {
+		return;
+	}
+
+	bool ok = true;
+	auto start = bench_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		ok = f() && ok;
+	}
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+	report(group, name, iterations, seconds, items, ok);
+}
+
+static volatile size_t sink; //防止结果被优化掉
+
+//operator new的调用次数，check组用它确认结果缓冲区被复用
+static std::atomic<size_t> allocations{ 0 };
+
+void* operator new(size_t n) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(n == 0 ? 1 : n)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+//内联后gcc会把free和operator new配对，误报-Wmismatched-new-delete
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+//让编译器认为value被读写过，循环不会被常量折叠
+template<typename V>
+static void keep(V& value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+static narrow make_narrow(int i) {
+	return narrow{ i, "name_" + std::to_string(i), i % 100 };
+}
+
+static wide make_wide(int i) {
+	std::string s(32, 'a' + i % 26);
+	return wide{ i, i, (int64_t)i * 1000, i * 0.5, i * 0.25, i % 7, s, s, s, s, s,
+		i % 2 ? std::optional<std::string>(s) : std::nullopt };
+}
+
+template<typename T, typename F>
+static std::vector<T> make_rows(size_t count, F make) {
+	std::vector<T> v;
+	v.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		v.push_back(make((int)i + 1));
+	}
+	return v;
+}
+
+static void bench_sqlgen() {
+	narrow n = make_narrow(1);
+	wide w = make_wide(1);
+
+	run_cpu("sqlgen", "forEach/narrow", 1, [&] {
+		manjusaka::forEach(n, [&](auto&& fieldName, auto&& value) { keep(value); });
+	});
+
+	run_cpu("sqlgen", "forEach/wide", 1, [&] {
+		manjusaka::forEach(w, [&](auto&& fieldName, auto&& value) { keep(value); });
+	});
+
+	run_cpu("sqlgen", "generate_insert_sql/1", 1, [&] {
+		sink = manjusaka::generate_insert_sql<wide>().size();
+	});
+
+	run_cpu("sqlgen", "generate_insert_sql/1000", 1, [&] {
+		sink = manjusaka::generate_insert_sql<wide>(1000).size();
+	});
+
+	run_cpu("sqlgen", "generate_select_sql", 1, [&] {
+		sink = manjusaka::generate_select_sql<wide>("where id > 10 order by id").size();
+	});
+
+	run_cpu("sqlgen", "generate_update_by_key_sql", 1, [&] {
+		sink = manjusaka::generate_update_by_key_sql<wide>(0).size();
+	});
+
+	run_cpu("sqlgen", "generate_upsert_sql/1000", 1, [&] {
+		sink = manjusaka::generate_upsert_sql<wide>(1000).size();
+	});
+
+	std::array<MYSQL_BIND, wide::field_count> binds;
+	run_cpu("sqlgen", "param_layout_bind/wide", 1, [&] {
+		keep(w);
+		manjusaka::param_layout<wide>::bind(w, binds.data());
+		keep(binds);
+	});
+}
+
+/*
+* 每个线程不停地借出归还连接，连接数和线程数相同
+* 后端是memory_db，只有连接池本身的开销
+*/
+static void bench_pool() {
+	for (size_t threads = 1; threads <= 64; threads *= 2) {
+		std::string name = "get/" + std::to_string(threads);
+		if (!selected("pool", name)) {
+			continue;
+		}
+
+		manjusaka::connection_pool<manjusaka::memory_db> pool;
+		manjusaka::pool_config config;
+		config.min_idle = threads;
+		config.max_total = threads;
+		pool.init(config);
+
+		std::atomic<bool> stop{ false };
+		std::atomic<size_t> total{ 0 };
+		std::vector<std::thread> workers;
+		auto start = bench_clock::now();
+		for (size_t t = 0; t < threads; t++) {
+			workers.emplace_back([&] {
+				size_t count = 0;
+				while (!stop.load(std::memory_order_relaxed)) {
+					auto con = pool.get();
+					count += con ? 1 : 0;
+				}
+				total += count;
+			});
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		stop = true;
+		for (auto& t : workers) {
+			t.join();
+		}
+		double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+		report("pool", name, total, seconds, 1);
+	}
+}
+
+template<typename DB>
+static bool reset_tables(DB& db) {
+	return db.execute("create table if not exists bench_narrow(id int primary key, name varchar(64), age int)") &&
+		db.execute("create table if not exists bench_wide(id int primary key, a int, b bigint, c double, d double,"
+			" e int, s1 text, s2 text, s3 text, s4 text, s5 text, note text)") &&
+		db.execute("truncate table bench_narrow") &&
+		db.execute("truncate table bench_wide");
+}
+
+template<typename DB>
+static void bench_insert(DB& db) {
+	auto rows = make_rows<narrow>(opt.rows, make_narrow);
+	auto wide_rows = make_rows<wide>(opt.rows, make_wide);
+	size_t single = (std::min)(opt.rows, (size_t)2000);
+
+	reset_tables(db);
+	size_t i = 0;
+	run_db("insert", "single/narrow", single, 1, [&] { return db.insert(rows[i++]) == 1; });
+
+	reset_tables(db);
+	run_db("insert", "batch/narrow", 1, rows.size(), [&] { return db.insert(rows) == (int)rows.size(); });
+
+	reset_tables(db);
+	run_db("insert", "batch/wide", 1, wide_rows.size(), [&] {
+		return db.insert(wide_rows) == (int)wide_rows.size();
+	});
+
+	reset_tables(db);
+	run_db("insert", "bulk_load/narrow", 1, rows.size(), [&] {
+		return db.template bulk_load<narrow>(rows) == (long long)rows.size();
+	});
+
+	reset_tables(db);
+	run_db("insert", "bulk_load/wide", 1, wide_rows.size(), [&] {
+		return db.template bulk_load<wide>(wide_rows) == (long long)wide_rows.size();
+	});
+}
+
+static bool check_failed = false;
+
+static void report_check(const std::string& name, bool ok, size_t allocs) {
+	printf("{\"group\":\"check\",\"name\":\"%s\",\"ok\":%s,\"allocations\":%zu}\n",
+		name.c_str(), ok ? "true" : "false", allocs);
+	fflush(stdout);
+	check_failed = check_failed || !ok;
+}
+
+static bool same_wide(const wide& a, const wide& b) {
+	return a.id == b.id && a.s1 == b.s1 && a.s2 == b.s2 && a.s3 == b.s3 && a.s4 == b.s4 &&
+		a.s5 == b.s5 && a.note == b.note;
+}
+
+/*
+* 结果绑定的正确性检查
+* truncate: 字符串比default_column_buffer长，不缓冲的结果集先被截断再补取，之后较短的行也要正确
+* reuse: 同一个查询重复执行，结果缓冲区复用，稳定后每次分配的次数不变且和行数无关
+*/
+static void bench_check(mysql& db) {
+	if (!selected("check", "")) {
+		return;
+	}
+
+	reset_tables(db);
+	std::vector<wide> rows = make_rows<wide>(4, make_wide);
+	std::string big(3 * manjusaka::result_binder<wide>::default_column_buffer + 17, 'x');
+	for (size_t i = 0; i < big.size(); i++) {
+		big[i] = (char)('a' + i % 26);
+	}
+	rows[1].s1 = big;
+	rows[1].s4 = big + big;
+	rows[1].note = big;
+	db.insert(rows);
+
+	auto check_rows = [&](const std::vector<wide>& got) {
+		bool ok = got.size() == rows.size();
+		for (size_t i = 0; ok && i < rows.size(); i++) {
+			ok = same_wide(got[i], rows[i]);
+		}
+		return ok;
+	};
+
+	report_check("truncate/query", check_rows(db.query<wide>("order by id")), 0);
+
+	std::vector<wide> got;
+	bool ok = db.for_each_row<wide>("order by id", [&](wide& w) { got.push_back(w); });
+	report_check("truncate/for_each_row", ok && check_rows(got), 0);
+
+	auto cols = db.query_columns<wide>("order by id");
+	auto& s1 = cols.get<manjusaka::field_index<wide>("s1")>();
+	auto& s4 = cols.get<manjusaka::field_index<wide>("s4")>();
+	ok = cols.size() == rows.size();
+	for (size_t i = 0; ok && i < rows.size(); i++) {
+		ok = s1[i] == rows[i].s1 && s4[i] == rows[i].s4;
+	}
+	report_check("truncate/columns", ok, 0);
+
+	//名字都在短字符串优化的范围内，对象本身不分配内存
+	reset_tables(db);
+	size_t count = (std::min)(opt.rows, (size_t)1000);
+	db.insert(make_rows<narrow>(count, make_narrow));
+	size_t steady[2] = {};
+	ok = true;
+	for (size_t i = 0; i < 3; i++) {
+		size_t before = allocations.load();
+		ok = db.query<narrow>().size() == count && ok;
+		if (i > 0) {
+			steady[i - 1] = allocations.load() - before;
+		}
+	}
+	report_check("reuse/query", ok && steady[0] == steady[1] && steady[1] < count, steady[1]);
+}
+
+/*
+* bulk_writer的唤醒检查，后端是memory_db，不需要数据库
+* 一个工作线程、每块一行、队列长度1，多个线程同时write后finish，每轮都要写完而且不能卡住
+* 卡住时没有办法恢复，报告失败后直接退出
+*/
+static void bench_check_writer() {
+	if (!selected("check", "bulk_writer/wakeup")) {
+		return;
+	}
+
+	manjusaka::connection_pool<manjusaka::memory_db> pool;
+	pool.init(2, "", "", "", "bench_writer");
+
+	static constexpr size_t rounds = 500, producers = 6, per_producer = 20;
+	std::atomic<bool> done{ false };
+	bool ok = true;
+	std::thread runner([&] {
+		int id = 0;
+		for (size_t r = 0; r < rounds && ok; r++) {
+			manjusaka::bulk_writer<narrow, manjusaka::memory_db> writer(pool, { 1, 1, 1 });
+			std::vector<std::thread> threads;
+			for (size_t t = 0; t < producers; t++) {
+				int first = id;
+				id += (int)per_producer;
+				threads.emplace_back([&writer, first] {
+					for (size_t i = 0; i < per_producer; i++) {
+						writer.write(make_narrow(first + (int)i));
+					}
+				});
+			}
+			for (auto& t : threads) {
+				t.join();
+			}
+			ok = writer.finish().rows_written == producers * per_producer;
+		}
+		done = true;
+	});
+
+	auto deadline = bench_clock::now() + std::chrono::seconds(60);
+	while (!done && bench_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	if (!done) {
+		report_check("bulk_writer/wakeup", false, 0);
+		std::_Exit(2);
+	}
+	runner.join();
+	report_check("bulk_writer/wakeup", ok, 0);
+}
+
+//不拷贝成对象的几种结果形式，memory_db没有投影查询
+template<typename DB>
+static void bench_query_views(DB& db) {
+	run_db("query", "result_set/narrow", 5, opt.rows, [&] { return db.template query_result<narrow>().size() == opt.rows; });
+	run_db("query", "result_set/wide", 5, opt.rows, [&] { return db.template query_result<wide>().size() == opt.rows; });
+	run_db("query", "columns/narrow", 5, opt.rows, [&] { return db.template query_columns<narrow>().size() == opt.rows; });
+	run_db("query", "columns/wide", 5, opt.rows, [&] { return db.template query_columns<wide>().size() == opt.rows; });
+	if constexpr (std::is_same_v<DB, mysql>) {
+		run_db("query", "select/wide_id_name", 5, opt.rows, [&] {
+			return db.template select<&wide::id, &wide::s1>().size() == opt.rows;
+		});
+	}
+}
+
+//表中已经有opt.rows行，每种方式完整读取5次
+template<typename DB>
+static void bench_query(DB& db) {
+	reset_tables(db);
+	db.template bulk_load<narrow>(make_rows<narrow>(opt.rows, make_narrow));
+	db.template bulk_load<wide>(make_rows<wide>(opt.rows, make_wide));
+
+	run_db("query", "vector/narrow", 5, opt.rows, [&] { return db.template query<narrow>().size() == opt.rows; });
+	run_db("query", "vector/wide", 5, opt.rows, [&] { return db.template query<wide>().size() == opt.rows; });
+	run_db("query", "filter/narrow", 5, opt.rows / 2, [&] {
+		return db.template query<narrow>(manjusaka::where("id > ?"), (int)(opt.rows / 2)).size() == opt.rows - opt.rows / 2;
+	});
+
+	bench_query_views(db);
+
+	size_t point = (std::min)(opt.rows, (size_t)2000);
+	int id = 0;
+	run_db("query", "find_by_id/narrow", point, 1, [&] {
+		return db.template find_by_id<narrow>(++id).has_value();
+	});
+}
+
+int main(int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+		if (arg == "--no-db" || arg == "--memory") {
+			(arg == "--no-db" ? opt.no_db : opt.memory) = true;
+			continue;
+		}
+
+		if (arg == "--host") opt.host = value;
+		else if (arg == "--port") opt.port = atoi(value);
+		else if (arg == "--user") opt.user = value;
+		else if (arg == "--password") opt.password = value;
+		else if (arg == "--database") opt.database = value;
+		else if (arg == "--rows") opt.rows = (size_t)(std::max)(1LL, atoll(value));
+		else if (arg == "--filter") opt.filter = value;
+		else {
+			cerr << "unknown option " << arg << endl;
+			return 1;
+		}
+		i++;
+	}
+
+	bench_sqlgen();
+	bench_pool();
+	bench_check_writer();
+
+	if (opt.no_db) {
+		return check_failed ? 2 : 0;
+	}
+
+	if (opt.memory) {
+		manjusaka::memory_db db;
+		db.connect();
+		bench_insert(db);
+		bench_query(db);
+		return check_failed ? 2 : 0;
+	}
+
+	mysql db;
+	if (!db.connect(opt.host, opt.user, opt.password, opt.database, 5, opt.port)) {
+		cerr << "can not connect to " << opt.host << ":" << opt.port << endl;
+		return 1;
+	}
+
+	bench_check(db);
+	bench_insert(db);
+	bench_query(db);
+	return check_failed ? 2 : 0;
+}
@@ -0,0 +1,283 @@
+#ifndef ASYNC_MYSQL_H
+#define ASYNC_MYSQL_H
+
+#include<string>
+#include<vector>
+#include<mysql/mysql.h>
+
+#include"operation.hpp"
+#include"reflection.hpp"
+#include"text_protocol.hpp"
+#include"result_cache.hpp"
+#include"event_loop.hpp"
+
+#ifdef __linux__
+
+/*
+* 基于非阻塞接口的异步连接，所有操作返回manjusaka::task，在event_loop中co_await
+* libmysqlclient没有预处理语句的非阻塞接口，这里使用文本协议，参数在客户端转义后写进sql
+* 一个连接同一时间只能有一个操作在进行，并发靠多个连接
+*
+* manjusaka::event_loop loop;
+* async_mysql db(loop);
+* loop.spawn([](async_mysql& db) -> manjusaka::task<> {
+*     co_await db.connect("127.0.0.1", "root", "123456", "test");
+*     auto v = co_await db.query<Person>("where age > 18");
+* }(db));
+* loop.run();
+*/
+class async_mysql {
+public:
+	explicit async_mysql(manjusaka::event_loop& loop) : loop_(loop) {}
+	~async_mysql() { disconnect(); }
+	async_mysql(const async_mysql&) = delete;
+	async_mysql& operator=(const async_mysql&) = delete;
+
+	manjusaka::task<bool> connect(std::string ip, std::string usr, std::string pwd,
+		std::string dbn, unsigned int port = 0) {
+		disconnect();
+		con_ = mysql_init(nullptr);
+		if (con_ == nullptr) {
+			co_return false;
+		}
+
+		mysql_options(con_, MYSQL_SET_CHARSET_NAME, "utf8");
+		auto status = co_await wait_for([&] {
+			return mysql_real_connect_nonblocking(con_, ip.c_str(), usr.c_str(), pwd.c_str(),
+				dbn.c_str(), port, nullptr, 0);
+		});
+		co_return status == NET_ASYNC_COMPLETE;
+	}
+
+	bool disconnect() {
+		if (con_ != nullptr) {
+			loop_.unregister(io_);
+			mysql_close(con_);
+			con_ = nullptr;
+		}
+		return true;
+	}
+
+	//insert into Person(id, name, age) values(1, 'JOJO', 15); 返回影响的行数，出错返回-1
+	template<typename T>
+	manjusaka::task<int> insert(const T& t) {
+		if (con_ == nullptr) {
+			co_return -1;
+		}
+
+		const T* first = &t;
+		int r = co_await execute_update(manjusaka::generate_insert_values_sql(con_, first, first + 1));
+		if (r >= 0) {
+			invalidate_cache(T::TABLE_NAME());
+		}
+		co_return r;
+	}
+
+	/*
+	* 多行插入，每条语句最多batch_rows_行、max_statement_size字节
+	* 全部语句在一个事务中执行，任何一条失败都回滚，返回-1
+	* 协程挂起期间t必须保持有效
+	*/
+	template<typename T>
+	manjusaka::task<int> insert(const std::vector<T>& t) {
+		if (con_ == nullptr) {
+			co_return -1;
+		}
+
+		if (t.empty()) {
+			co_return 0;
+		}
+
+		if (!co_await begin()) {
+			co_return -1;
+		}
+
+		int count = 0;
+		const T* first = t.data();
+		const T* last = t.data() + t.size();
+		while (first != last) {
+			int r = co_await execute_update(manjusaka::generate_insert_values_sql(con_, first, last,
+				batch_rows_, max_statement_size));
+			if (r < 0) {
+				co_await rollback();
+				co_return -1;
+			}
+			count += r;
+		}
+
+		invalidate_cache(T::TABLE_NAME());
+		if (!co_await commit()) {
+			co_return -1;
+		}
+		co_return count;
+	}
+
+	void set_batch_rows(size_t rows) { batch_rows_ = rows == 0 ? 1 : rows; }
+
+	//和mysql::query一样，反射对象传入条件，tuple传入完整的sql
+	template<typename T, typename... Args>
+	std::enable_if_t<manjusaka::is_reflection_v<T>, manjusaka::task<std::vector<T>>> query(Args &&...args) {
+		std::string condition = "";
+		manjusaka::append(condition, std::forward<Args>(args)...);
+		return query_impl<T>(manjusaka::generate_select_sql<T>(condition));
+	}
+
+	template<typename T>
+	std::enable_if_t<!manjusaka::is_reflection_v<T>, manjusaka::task<std::vector<T>>> query(std::string sql) {
+		static_assert(manjusaka::is_tuple_v<T>);
+		return query_impl<T>(std::move(sql));
+	}
+
+	template<typename T, typename... Args>
+	manjusaka::task<bool> delete_records(Args &&... args) {
+		std::string condition = "";
+		manjusaka::append(condition, std::forward<Args>(args)...);
+		return delete_impl(manjusaka::generate_delete_sql<T>(condition), T::TABLE_NAME());
+	}
+
+	//不知道sql修改了哪些表，使整个结果缓存失效
+	manjusaka::task<bool> execute(std::string sql) {
+		bool ok = co_await run(sql);
+		if (ok) {
+			invalidate_cache();
+		}
+		co_return ok;
+	}
+
+	// transaction
+	manjusaka::task<bool> begin() { return run("BEGIN"); }
+	manjusaka::task<bool> commit() { return end_transaction("COMMIT"); }
+	manjusaka::task<bool> rollback() { return end_transaction("ROLLBACK"); }
+
+	MYSQL* native_handle() const { return con_; }
+
+private:
+	/*
+	* 反复调用非阻塞接口直到完成，没准备好时挂起等待socket事件
+	* 接口不会告诉我们它在等读还是等写，所以读写一直都在监听(边沿触发，见event_loop::io_source)：
+	* 大的请求一次写不完时，缓冲区腾出空间后被可写事件唤醒继续发送
+	* 请求发完以后socket虽然可写但不会再触发，等待结果时只会被可读事件唤醒
+	*/
+	template<typename F>
+	manjusaka::task<net_async_status> wait_for(F f) {
+		net_async_status status;
+		while ((status = f()) == NET_ASYNC_NOT_READY) {
+			if (co_await loop_.wait_io(io_, mysql_get_socket(con_)) == 0) {
+				co_return NET_ASYNC_ERROR;
+			}
+		}
+		co_return status;
+	}
+
+	manjusaka::task<bool> run(std::string sql) {
+		co_return co_await real_query(sql) && co_await discard_result();
+	}
+
+	manjusaka::task<bool> delete_impl(std::string sql, std::string_view table) {
+		bool ok = co_await run(sql);
+		if (ok) {
+			invalidate_cache(table);
+		}
+		co_return ok;
+	}
+
+	//事务中有写操作时，提交或回滚后再使一次缓存失效
+	manjusaka::task<bool> end_transaction(std::string sql) {
+		bool ok = co_await run(sql);
+		if (dirty_) {
+			manjusaka::result_cache::instance().invalidate_all();
+			dirty_ = false;
+		}
+		co_return ok;
+	}
+
+	void invalidate_cache(std::string_view table) {
+		manjusaka::result_cache::instance().invalidate(table);
+		dirty_ = dirty_ || in_transaction();
+	}
+
+	void invalidate_cache() {
+		manjusaka::result_cache::instance().invalidate_all();
+		dirty_ = dirty_ || in_transaction();
+	}
+
+	bool in_transaction() const {
+		return con_ != nullptr && (con_->server_status & SERVER_STATUS_IN_TRANS) != 0;
+	}
+
+	manjusaka::task<bool> real_query(const std::string& sql) {
+		if (con_ == nullptr) {
+			co_return false;
+		}
+
+		auto status = co_await wait_for([&] {
+			return mysql_real_query_nonblocking(con_, sql.data(), (unsigned long)sql.size());
+		});
+		co_return status == NET_ASYNC_COMPLETE;
+	}
+
+	//insert、update等语句没有结果集，有结果集时要读完，否则连接上的下一条语句会失败
+	manjusaka::task<bool> discard_result() {
+		if (mysql_field_count(con_) == 0) {
+			co_return true;
+		}
+
+		MYSQL_RES* res = nullptr;
+		auto status = co_await wait_for([&] {
+			return mysql_store_result_nonblocking(con_, &res);
+		});
+		if (res != nullptr) {
+			mysql_free_result(res);
+		}
+		co_return status == NET_ASYNC_COMPLETE;
+	}
+
+	manjusaka::task<int> execute_update(std::string sql) {
+		if (!co_await real_query(sql) || !co_await discard_result()) {
+			co_return -1;
+		}
+		co_return (int)mysql_affected_rows(con_);
+	}
+
+	template<typename T>
+	manjusaka::task<std::vector<T>> query_impl(std::string sql) {
+		std::vector<T> v;
+		if (!co_await real_query(sql)) {
+			co_return v;
+		}
+
+		//结果集在store_result中异步读完，之后的fetch_row不再和服务端通信
+		MYSQL_RES* res = nullptr;
+		auto status = co_await wait_for([&] {
+			return mysql_store_result_nonblocking(con_, &res);
+		});
+		if (status != NET_ASYNC_COMPLETE || res == nullptr) {
+			co_return v;
+		}
+
+		if (mysql_num_fields(res) == manjusaka::field_count_of_v<T>) {
+			v.reserve((size_t)mysql_num_rows(res));
+			MYSQL_ROW row;
+			while ((row = mysql_fetch_row(res)) != nullptr) {
+				T t{};
+				manjusaka::read_text_row(t, row, mysql_fetch_lengths(res));
+				v.push_back(std::move(t));
+			}
+		}
+
+		mysql_free_result(res);
+		co_return v;
+	}
+
+	manjusaka::event_loop& loop_;
+	MYSQL* con_{ nullptr };
+	manjusaka::event_loop::io_source io_;
+	size_t batch_rows_{ 1000 };
+	bool dirty_{ false }; //事务中是否有写操作
+	//低于服务端max_allowed_packet的默认值(4MB)，不用额外查询
+	static constexpr size_t max_statement_size = 1024 * 1024;
+};
+
+#endif //__linux__
+
+#endif //ASYNC_MYSQL_H
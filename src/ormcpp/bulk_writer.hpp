@@ -0,0 +1,251 @@
+#ifndef BULK_WRITER_H
+#define BULK_WRITER_H
+
+#include<mutex>
+#include<deque>
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+
+#include"connection_pool.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 并行批量写入的选项
+	* workers : 同时写入的连接数，每个连接一个线程，不要超过连接池的max_total
+	* chunk_rows : 每块的行数，一块在一个事务中写入
+	* max_pending : 最多排队的块数，队列满时write会阻塞，在途的行数不超过(max_pending + workers + 1) * chunk_rows
+	*/
+	struct bulk_writer_options {
+		size_t workers{ 4 };
+		size_t chunk_rows{ 5000 };
+		size_t max_pending{ 8 };
+	};
+
+	struct bulk_writer_stats {
+		size_t rows_written{ 0 };
+		size_t chunks_written{ 0 };
+		size_t chunks_failed{ 0 };
+		double seconds{ 0 };
+
+		double rows_per_second() const { return seconds > 0 ? rows_written / seconds : 0; }
+	};
+
+	//写入失败的块，sequence是块提交的顺序，rows原样保留，可以单独重试
+	template<typename T>
+	struct bulk_chunk {
+		size_t sequence{ 0 };
+		std::vector<T> rows;
+	};
+
+	/*
+	* 把大量数据切成块，分给连接池中的多个连接同时写入
+	* 可以在多个线程中调用write，前面的块还在写入时可以继续提供数据
+	* 每块借一次连接，用DB::insert(std::vector<T>)在一个事务中写入，失败的块整体回滚
+	* finish()或析构时写完剩下的数据并等待所有块完成，finish()之后写入的函数都返回false
+	* 失败的块要在finish()之前取出重试，或者交给新的bulk_writer
+	*
+	* manjusaka::bulk_writer<Person> writer(ormcpp<mysql>::instance());
+	* for (auto& p : people) writer.write(p);
+	* auto stats = writer.finish();
+	* manjusaka::bulk_writer<Person> retry(ormcpp<mysql>::instance());
+	* for (auto& chunk : writer.take_failures()) retry.submit(std::move(chunk.rows));
+	*/
+	template<typename T, typename DB = mysql>
+	class bulk_writer {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit bulk_writer(connection_pool<DB>& pool, const bulk_writer_options& opt = {})
+			:pool_(pool), opt_(opt) {
+			opt_.workers = (std::max)(opt_.workers, (size_t)1);
+			opt_.chunk_rows = (std::max)(opt_.chunk_rows, (size_t)1);
+			opt_.max_pending = (std::max)(opt_.max_pending, (size_t)1);
+			current_.reserve(opt_.chunk_rows);
+
+			workers_.reserve(opt_.workers);
+			for (size_t i = 0; i < opt_.workers; i++) {
+				workers_.emplace_back(&bulk_writer::work, this);
+			}
+		}
+
+		~bulk_writer() { finish(); }
+
+		bulk_writer(const bulk_writer&) = delete;
+		bulk_writer& operator=(const bulk_writer&) = delete;
+
+		//finish()之后返回false，这一行不会被写入
+		bool write(const T& row) {
+			std::unique_lock<std::mutex> lock(mtx_);
+			if (closing_) {
+				return false;
+			}
+
+			current_.push_back(row);
+			if (current_.size() >= opt_.chunk_rows) {
+				enqueue(lock); //等待期间finish()了也没关系，finish()会先提交current_
+			}
+			return true;
+		}
+
+		bool write(T&& row) {
+			std::unique_lock<std::mutex> lock(mtx_);
+			if (closing_) {
+				return false;
+			}
+
+			current_.push_back(std::move(row));
+			if (current_.size() >= opt_.chunk_rows) {
+				enqueue(lock);
+			}
+			return true;
+		}
+
+		//直接提交一整块，不和其他行合并，可用于重试失败的块，finish()之后返回false
+		bool submit(std::vector<T> rows) {
+			if (rows.empty()) {
+				return true;
+			}
+
+			std::unique_lock<std::mutex> lock(mtx_);
+			if (!wait_not_full(lock)) {
+				return false;
+			}
+
+			queue_.push_back(bulk_chunk<T>{ next_sequence_++, std::move(rows) });
+			not_empty_.notify_one();
+			return true;
+		}
+
+		//把不满一块的数据也提交
+		bool flush() {
+			std::unique_lock<std::mutex> lock(mtx_);
+			return enqueue(lock);
+		}
+
+		//提交剩下的数据，等待所有块写完，之后不能再写入
+		bulk_writer_stats finish() {
+			{
+				std::unique_lock<std::mutex> lock(mtx_);
+				if (!closing_) {
+					enqueue(lock);
+					closing_ = true;
+				}
+			}
+			not_empty_.notify_all();
+			not_full_.notify_all(); //队列满时等待的write和submit返回false
+
+			for (auto& t : workers_) {
+				if (t.joinable()) {
+					t.join();
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mtx_);
+			if (finished_ == clock::time_point{}) {
+				finished_ = clock::now();
+			}
+			return stats_locked();
+		}
+
+		//写入过程中也可以查看进度
+		bulk_writer_stats stats() const {
+			std::lock_guard<std::mutex> lock(mtx_);
+			return stats_locked();
+		}
+
+		std::vector<bulk_chunk<T>> take_failures() {
+			std::lock_guard<std::mutex> lock(mtx_);
+			return std::move(failures_);
+		}
+
+	private:
+		//调用时持有mtx_，队列满时等待，已经finish()时返回false
+		bool enqueue(std::unique_lock<std::mutex>& lock) {
+			if (!wait_not_full(lock)) {
+				return false;
+			}
+
+			//等待期间其他线程可能已经提交了current_
+			if (current_.empty()) {
+				return true;
+			}
+
+			queue_.push_back(bulk_chunk<T>{ next_sequence_++, std::move(current_) });
+			current_ = {};
+			current_.reserve(opt_.chunk_rows);
+			not_empty_.notify_one();
+			return true;
+		}
+
+		//工作线程退出后队列不会再被取走，这时不能再放入，返回false
+		bool wait_not_full(std::unique_lock<std::mutex>& lock) {
+			not_full_.wait(lock, [this] { return queue_.size() < opt_.max_pending || closing_; });
+			return !closing_;
+		}
+
+		void work() {
+			while (true) {
+				bulk_chunk<T> chunk;
+				{
+					std::unique_lock<std::mutex> lock(mtx_);
+					not_empty_.wait(lock, [this] { return !queue_.empty() || closing_; });
+					if (queue_.empty()) {
+						return;
+					}
+					chunk = std::move(queue_.front());
+					queue_.pop_front();
+				}
+				//等待的生产者醒来后可能发现current_已经被别人提交，什么都不放就返回
+				//只唤醒一个会把这个空位浪费掉，其他等待者(包括finish)永远等下去
+				not_full_.notify_all();
+
+				int r = -1;
+				{
+					auto con = pool_.get();
+					if (con) {
+						r = con->insert(chunk.rows);
+					}
+				}
+
+				std::lock_guard<std::mutex> lock(mtx_);
+				if (r < 0) {
+					stats_.chunks_failed++;
+					failures_.push_back(std::move(chunk));
+				}
+				else {
+					stats_.chunks_written++;
+					stats_.rows_written += chunk.rows.size();
+				}
+			}
+		}
+
+		bulk_writer_stats stats_locked() const {
+			bulk_writer_stats s = stats_;
+			auto end = finished_ == clock::time_point{} ? clock::now() : finished_;
+			s.seconds = std::chrono::duration<double>(end - started_).count();
+			return s;
+		}
+
+		connection_pool<DB>& pool_;
+		bulk_writer_options opt_;
+		clock::time_point started_{ clock::now() };
+		clock::time_point finished_{};
+
+		mutable std::mutex mtx_;
+		std::condition_variable not_empty_; //有块可写或者结束
+		std::condition_variable not_full_; //队列有空位
+		std::vector<T> current_; //正在填充的块
+		std::deque<bulk_chunk<T>> queue_;
+		size_t next_sequence_{ 0 };
+		bool closing_{ false };
+		bulk_writer_stats stats_;
+		std::vector<bulk_chunk<T>> failures_;
+		std::vector<std::thread> workers_;
+	};
+}
+
+#endif //BULK_WRITER_H
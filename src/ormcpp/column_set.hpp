@@ -0,0 +1,165 @@
+#ifndef COLUMN_SET_H
+#define COLUMN_SET_H
+
+#include<tuple>
+#include<vector>
+#include<string>
+#include<string_view>
+#include<optional>
+#include<utility>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	//数值列，所有行的值连续存放，可以直接交给向量化的循环
+	template<typename U, typename = void>
+	class column {
+	public:
+		size_t size() const { return values_.size(); }
+		const U* data() const { return values_.data(); }
+		const U& operator[](size_t i) const { return values_[i]; }
+		const std::vector<U>& values() const { return values_; }
+
+		void reserve(size_t rows) { values_.reserve(rows); }
+		void clear() { values_.clear(); }
+
+		template<typename Binder>
+		void append(const Binder& binder, size_t i) {
+			values_.push_back(binder.template scalar<U>(i));
+		}
+
+	private:
+		std::vector<U> values_;
+	};
+
+	/*
+	* 字符串和blob列，所有行的数据首尾相接放在一个缓冲区里
+	* 第i行是bytes[offsets[i], offsets[i + 1])
+	*/
+	class bytes_column {
+	public:
+		size_t size() const { return offsets_.size() - 1; }
+		std::string_view operator[](size_t i) const {
+			return { bytes_.data() + offsets_[i], offsets_[i + 1] - offsets_[i] };
+		}
+		const std::vector<char>& bytes() const { return bytes_; }
+		const std::vector<size_t>& offsets() const { return offsets_; }
+
+		void reserve(size_t rows) { offsets_.reserve(rows + 1); }
+		void clear() {
+			bytes_.clear();
+			offsets_.assign(1, 0);
+		}
+
+		template<typename Binder>
+		void append(const Binder& binder, size_t i) {
+			std::string_view value = binder.column(i);
+			bytes_.insert(bytes_.end(), value.begin(), value.end());
+			offsets_.push_back(bytes_.size());
+		}
+
+	private:
+		std::vector<char> bytes_;
+		std::vector<size_t> offsets_{ 0 };
+	};
+
+	template<typename U>
+	class column<U, std::enable_if_t<std::is_same_v<std::string, U> || std::is_same_v<blob, U> ||
+		is_char_array_v<U> || is_char_std_array_v<U>>> : public bytes_column {};
+
+	/*
+	* optional列，值按内部类型存放，NULL的行存0或空串以保持行号对齐
+	* 另外用位图记录哪些行有值，第i行对应validity[i / 64]的第i % 64位
+	*/
+	template<typename U>
+	class column<std::optional<U>> : public column<U> {
+	public:
+		bool valid(size_t i) const { return (validity_[i / 64] >> (i % 64)) & 1; }
+		const std::vector<uint64_t>& validity() const { return validity_; }
+		size_t null_count() const { return null_count_; }
+
+		void reserve(size_t rows) {
+			column<U>::reserve(rows);
+			validity_.reserve((rows + 63) / 64);
+		}
+
+		void clear() {
+			column<U>::clear();
+			validity_.clear();
+			null_count_ = 0;
+		}
+
+		template<typename Binder>
+		void append(const Binder& binder, size_t i) {
+			size_t row = column<U>::size();
+			if (row % 64 == 0) {
+				validity_.push_back(0);
+			}
+
+			if (binder.is_null(i)) {
+				null_count_++;
+			}
+			else {
+				validity_.back() |= uint64_t(1) << (row % 64);
+			}
+			column<U>::append(binder, i);
+		}
+
+	private:
+		std::vector<uint64_t> validity_;
+		size_t null_count_{ 0 };
+	};
+
+	/*
+	* 列式的查询结果，反射对象的每个字段一列
+	* 汇总一两列的时候只访问这几列的连续内存，不需要逐行构造对象
+	*
+	* auto cols = db.query_columns<Person>("where age > 18");
+	* auto& age = cols.get<manjusaka::field_index<Person>("age")>();
+	* long long sum = std::accumulate(age.data(), age.data() + age.size(), 0LL);
+	*/
+	template<typename T>
+	class column_set {
+	public:
+		static constexpr size_t size_v = T::field_count;
+
+		size_t size() const { return rows_; }
+		bool empty() const { return rows_ == 0; }
+
+		//第I列，I和DEFINE_TABLE中字段的顺序一致
+		template<size_t I>
+		const auto& get() const { return std::get<I>(columns_); }
+
+		void reserve(size_t rows) {
+			std::apply([&](auto&... col) { (col.reserve(rows), ...); }, columns_);
+		}
+
+		void clear() {
+			std::apply([&](auto&... col) { (col.clear(), ...); }, columns_);
+			rows_ = 0;
+		}
+
+		//追加binder当前行的所有列
+		template<typename Binder>
+		void append(const Binder& binder) {
+			append(binder, std::make_index_sequence<size_v>{});
+			rows_++;
+		}
+
+	private:
+		template<typename Binder, size_t... Is>
+		void append(const Binder& binder, std::index_sequence<Is...>) {
+			(std::get<Is>(columns_).append(binder, Is), ...);
+		}
+
+		template<size_t... Is>
+		static auto make_columns(std::index_sequence<Is...>) -> std::tuple<column<field_type_t<T, Is>>...>;
+
+		decltype(make_columns(std::make_index_sequence<size_v>{})) columns_;
+		size_t rows_{ 0 };
+	};
+}
+
+#endif //COLUMN_SET_H
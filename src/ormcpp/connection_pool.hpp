@@ -3,114 +3,446 @@
 
 #include<memory>
 #include<mutex>
-#include<queue>
+#include<deque>
+#include<vector>
+#include<atomic>
 #include<chrono>
 #include<tuple>
 #include<thread>
+#include<functional>
 #include<condition_variable>
 
 #include"mysql.hpp"
 
 namespace manjusaka{
 
+	/*
+	* 连接池的配置
+	* min_idle : 后台线程保证至少有这么多空闲连接
+	* max_total : 借出和空闲的连接总数上限，没有空闲连接时get会按需创建直到这个上限
+	* idle_timeout : 空闲超过这个时间且空闲数多于min_idle时关闭
+	* max_lifetime : 连接创建后最长使用的时间，到期后不再借出
+	* validation_interval : 空闲超过这个时间的连接借出前才需要ping，刚用过的连接直接借出
+	* maintenance_interval : 后台线程检查的间隔
+	* wait_timeout : get的默认等待时间
+	*/
+	struct pool_config {
+		size_t min_idle{ 3 };
+		size_t max_total{ 10 };
+		std::chrono::milliseconds idle_timeout{ std::chrono::minutes(10) };
+		std::chrono::milliseconds max_lifetime{ std::chrono::minutes(30) };
+		std::chrono::milliseconds validation_interval{ std::chrono::seconds(30) };
+		std::chrono::milliseconds maintenance_interval{ 500 };
+		std::chrono::milliseconds wait_timeout{ 3000 };
+	};
+
+	//连接池中的一个连接以及它的时间戳
+	template<typename DB>
+	struct pooled_connection {
+		using clock = std::chrono::steady_clock;
+
+		std::shared_ptr<DB> con;
+		clock::time_point created{ clock::now() };
+		clock::time_point idle_since{ clock::now() };
+		clock::time_point validated{ clock::now() };
+	};
+
+	template<typename DB>
+	class connection_pool;
+
+	/*
+	* 从连接池借出的连接，离开作用域时自动归还
+	* 归还时会调用DB::reset_session()回滚未结束的事务
+	*/
+	template<typename DB>
+	class connection_lease {
+	public:
+		connection_lease() = default;
+		connection_lease(std::nullptr_t) {}
+
+		connection_lease(connection_lease&& other) noexcept
+			:pool_(other.pool_), item_(std::move(other.item_)) {
+			other.pool_ = nullptr;
+		}
+
+		connection_lease& operator=(connection_lease&& other) noexcept {
+			if (this != &other) {
+				reset();
+				pool_ = other.pool_;
+				item_ = std::move(other.item_);
+				other.pool_ = nullptr;
+			}
+			return *this;
+		}
+
+		connection_lease(const connection_lease&) = delete;
+		connection_lease& operator=(const connection_lease&) = delete;
+
+		~connection_lease() { reset(); }
+
+		//提前归还
+		void reset() {
+			if (item_.con != nullptr) {
+				pool_->release(std::move(item_));
+				item_.con = nullptr;
+			}
+			pool_ = nullptr;
+		}
+
+		DB* get() const { return item_.con.get(); }
+		DB* operator->() const { return item_.con.get(); }
+		DB& operator*() const { return *item_.con; }
+		explicit operator bool() const { return item_.con != nullptr; }
+		bool operator==(std::nullptr_t) const { return item_.con == nullptr; }
+
+	private:
+		friend class connection_pool<DB>;
+
+		connection_lease(connection_pool<DB>* pool, pooled_connection<DB> item)
+			:pool_(pool), item_(std::move(item)) {}
+
+		connection_pool<DB>* pool_{ nullptr };
+		pooled_connection<DB> item_;
+	};
+
 	template<typename DB>
 	class connection_pool {
 	public:
+		using lease = connection_lease<DB>;
+		using clock = std::chrono::steady_clock;
+
 		static connection_pool<DB>& instance() {
 			static connection_pool<DB> instance;
 			return instance;
 		}
 
+		//除了instance()的全局连接池，也可以单独创建，例如读写分离时每个节点一个
+		connection_pool() = default;
+
+		~connection_pool() {
+			{
+				std::lock_guard<std::mutex> lock(maintain_mtx_);
+				stop_ = true;
+			}
+			maintain_cond_.notify_one();
+			if (maintainer_.joinable()) {
+				maintainer_.join();
+			}
+		}
+
+		connection_pool(const connection_pool&) = delete;
+		connection_pool& operator=(const connection_pool&) = delete;
+
+		//建立maxSize个连接，连接数固定
 		template<typename... Args>
 		void init(int maxSize, Args &&...args) {
+			pool_config config;
+			config.min_idle = maxSize;
+			config.max_total = maxSize;
+			init(config, std::forward<Args>(args)...);
+		}
+
+		template<typename... Args>
+		void init(const pool_config& config, Args &&...args) {
 			std::call_once(flag_, &connection_pool<DB>::template init_impl<Args...>,
-				this, maxSize, std::forward<Args>(args)...);
+				this, config, std::forward<Args>(args)...);
+		}
+
+		/*
+		* 取出一个空闲连接
+		* 先从本线程的分片里取最近归还的连接，没有时再去其他分片偷最久未用的
+		* 所有分片都空时，如果总数没到max_total就新建一个，否则等待，超过timeout返回nullptr
+		* 只有空闲超过validation_interval的连接才会ping
+		* init之前调用直接返回nullptr
+		*/
+		lease get() {
+			return get(config_.wait_timeout);
 		}
 
-		std::shared_ptr<DB> get() {
-			std::unique_lock<std::mutex> lock(mtx_);
-			while (conq_.empty()) {
-				if (std::cv_status::timeout == cond_.wait_for(lock, std::chrono::seconds(3))) {
+		lease get(std::chrono::milliseconds timeout) {
+			if (shards_ == nullptr) {
+				return nullptr;
+			}
+
+			auto deadline = clock::now() + timeout;
+			pooled_connection<DB> item;
+			while (true) {
+				if (try_get(item)) {
+					if (!needs_validation(item, clock::now()) || item.con->ping()) {
+						break;
+					}
+					discard(std::move(item));
+					continue;
+				}
+
+				if (try_create(item)) {
+					break;
+				}
+
+				std::unique_lock<std::mutex> lock(wait_mtx_);
+				waiters_++;
+				bool ready = cond_.wait_until(lock, deadline, [this] {
+					return idle_count_ > 0 || total_ < (long)config_.max_total;
+				});
+				waiters_--;
+				if (!ready) {
 					return nullptr; //timeout
 				}
 			}
 
-			auto con = conq_.front();
-			conq_.pop();
-			lock.unlock();
+			return lease(this, std::move(item));
+		}
+
+		std::chrono::milliseconds wait_timeout() const { return config_.wait_timeout; }
+
+		size_t idle_count() const { return idle_count_ > 0 ? (size_t)idle_count_ : 0; }
+		size_t total_count() const { return total_ > 0 ? (size_t)total_ : 0; }
 
-			if (con == nullptr or !con->ping()) {
-				add();
+	private:
+		friend class connection_lease<DB>;
+
+		//lease归还时调用，会话状态无法恢复或者到期的连接直接关闭，由后台线程补充
+		void release(pooled_connection<DB> item) {
+			auto now = clock::now();
+			if (now - item.created >= config_.max_lifetime || !item.con->reset_session()) {
+				discard(std::move(item));
+				return;
 			}
 
-			return con;
+			item.idle_since = now;
+			push(std::move(item), home_shard());
 		}
 
-		void produce() {
-			while (true) {
-				std::unique_lock<std::mutex> lock(mtx_);
-				while (conq_.size() >= 3) { //ĳminSize
-					cond_.wait(lock);
-				}
-				add();
+		//放到分片的尾部，本线程下次get时优先拿回
+		void push(pooled_connection<DB> item, size_t index) {
+			shard& s = shards_[index];
+			{
+				std::lock_guard<std::mutex> lock(s.mtx);
+				s.idle.push_back(std::move(item));
+				s.size = s.idle.size();
+			}
+
+			idle_count_++;
+			notify();
+		}
+
+		void discard(pooled_connection<DB> item) {
+			item.con = nullptr;
+			total_--;
+			notify();
+		}
+
+		void notify() {
+			if (waiters_ > 0) {
+				std::lock_guard<std::mutex> lock(wait_mtx_);
 				cond_.notify_one();
 			}
 		}
 
-		void recycle() {
-			while (true) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(500));
-				std::lock_guard<std::mutex> lock(mtx_);
-				while (conq_.size() > 3) { //ĳminSize
-					std::shared_ptr<DB> con = conq_.front();
-					if (con->getAliveTime() >= 3000) {
-						conq_.pop();
-						delete con;
+		bool needs_validation(const pooled_connection<DB>& item, clock::time_point now) const {
+			auto last = (std::max)(item.idle_since, item.validated);
+			return now - last >= config_.validation_interval;
+		}
+
+		template<typename... Args>
+		void init_impl(const pool_config& config, Args &&...args) {
+			//参数原样转给DB::connect，mysql可以再带上超时和端口
+			connect_ = [args = std::make_tuple(std::forward<Args>(args)...)](DB& db) {
+				return std::apply([&db](auto&... a) { return db.connect(a...); }, args);
+			};
+			config_ = config;
+			config_.max_total = (std::max)(config_.max_total, (size_t)1);
+			config_.min_idle = (std::min)(config_.min_idle, config_.max_total);
+
+			//分片数取CPU核数，但不超过连接数
+			size_t cores = (std::max)(1u, std::thread::hardware_concurrency());
+			shard_count_ = (std::max)((size_t)1, (std::min)(cores, config_.max_total));
+			shards_ = std::make_unique<shard[]>(shard_count_);
+
+			for (size_t i = 0; i < config_.min_idle; i++) {
+				auto con = add();
+				if (con == nullptr) {
+					throw std::invalid_argument("init falled");
+				}
+				total_++;
+				push(pooled_connection<DB>{ std::move(con) }, i % shard_count_);
+			}
+
+			maintainer_ = std::thread(&connection_pool<DB>::maintain, this);
+		}
+
+		/*
+		* 后台维护线程
+		* 关闭到期和空闲太久的连接，ping空闲超过validation_interval的连接，空闲数不足min_idle时补充
+		* 建立连接和ping都在分片的锁外面进行
+		*/
+		void maintain() {
+			std::unique_lock<std::mutex> lock(maintain_mtx_);
+			while (!stop_) {
+				maintain_cond_.wait_for(lock, config_.maintenance_interval);
+				if (stop_) {
+					break;
+				}
+
+				lock.unlock();
+				evict_and_validate();
+				refill();
+				lock.lock();
+			}
+		}
+
+		void evict_and_validate() {
+			std::vector<pooled_connection<DB>> expired;
+			std::vector<std::pair<pooled_connection<DB>, size_t>> to_validate;
+			auto now = clock::now();
+
+			for (size_t i = 0; i < shard_count_; i++) {
+				shard& s = shards_[i];
+				std::lock_guard<std::mutex> lock(s.mtx);
+				//front是最久没用的
+				for (auto it = s.idle.begin(); it != s.idle.end();) {
+					bool too_old = now - it->created >= config_.max_lifetime;
+					bool too_idle = now - it->idle_since >= config_.idle_timeout &&
+						idle_count_ > (long)config_.min_idle;
+					if (too_old || too_idle) {
+						expired.push_back(std::move(*it));
+					}
+					else if (needs_validation(*it, now)) {
+						to_validate.emplace_back(std::move(*it), i);
 					}
 					else {
-						break;
+						++it;
+						continue;
+					}
+
+					it = s.idle.erase(it);
+					idle_count_--;
+				}
+				s.size = s.idle.size();
+			}
+
+			for (auto& item : expired) {
+				discard(std::move(item));
+			}
+
+			for (auto& [item, index] : to_validate) {
+				if (item.con->ping()) {
+					item.validated = clock::now();
+					push(std::move(item), index);
+				}
+				else {
+					discard(std::move(item));
+				}
+			}
+		}
+
+		void refill() {
+			while (idle_count_ < (long)config_.min_idle && !stop_) {
+				long total = total_;
+				if (total >= (long)config_.max_total ||
+					!total_.compare_exchange_weak(total, total + 1)) {
+					if (total >= (long)config_.max_total) {
+						return;
 					}
+					continue;
 				}
+
+				auto con = add();
+				if (con == nullptr) {
+					total_--;
+					return;
+				}
+
+				push(pooled_connection<DB>{ std::move(con) }, next_refill_++ % shard_count_);
 			}
 		}
 
-	private:
-		template<typename... Args>
-		void init_impl(int maxSize, Args &&...args) {
-			args_ = std::make_tuple(std::forward<Args>(args)...);
+		/*
+		* 线程固定对应的分片，由线程id的哈希决定，和线程用过哪些连接池无关
+		* 哈希值再乘一次常数打散，pthread_t是对齐的地址，低位都相同
+		*/
+		size_t home_shard() const {
+			static thread_local uint64_t hash =
+				(uint64_t)std::hash<std::thread::id>{}(std::this_thread::get_id()) * 0x9E3779B97F4A7C15ull;
+			return (size_t)(hash >> 32) % shard_count_;
+		}
+
+		bool try_get(pooled_connection<DB>& item) {
+			size_t home = home_shard();
+			for (size_t i = 0; i < shard_count_; i++) {
+				shard& s = shards_[(home + i) % shard_count_];
+				if (s.size == 0) { //不加锁先看一眼，跳过空的分片
+					continue;
+				}
 
-			for (int i = 0; i < maxSize; i++) {
-				auto con = std::make_shared<DB>();
-				if (con->connect(std::forward<Args>(args)...)) {
-					conq_.push(con);
+				std::lock_guard<std::mutex> lock(s.mtx);
+				if (s.idle.empty()) {
+					continue;
+				}
+
+				if (i == 0) {
+					item = std::move(s.idle.back());
+					s.idle.pop_back();
 				}
 				else {
-					throw std::invalid_argument("init falled");
+					item = std::move(s.idle.front());
+					s.idle.pop_front();
 				}
+				s.size = s.idle.size();
+				idle_count_--;
+				return true;
 			}
+			return false;
+		}
+
+		//没有空闲连接时按需新建，总数不超过max_total
+		bool try_create(pooled_connection<DB>& item) {
+			long total = total_;
+			do {
+				if (total >= (long)config_.max_total) {
+					return false;
+				}
+			} while (!total_.compare_exchange_weak(total, total + 1));
+
+			auto con = add();
+			if (con == nullptr) {
+				total_--;
+				return false;
+			}
+
+			item = pooled_connection<DB>{ std::move(con) };
+			return true;
 		}
 
 		auto add() {
 			auto con = std::make_shared<DB>();
-			auto fn = [con](auto... args) {
-				return con->connect(args...);
-			};
-
-			return std::apply(fn, args_) ? con : nullptr;
+			return connect_(*con) ? con : nullptr;
 		}
 
-		connection_pool() = default;
-		~connection_pool() = default;
-		connection_pool(const connection_pool&) = delete;
-		connection_pool& operator=(const connection_pool&) = delete;
+		//每个分片独占一条缓存行，避免伪共享
+		struct alignas(64) shard {
+			std::mutex mtx;
+			std::deque<pooled_connection<DB>> idle;
+			std::atomic<size_t> size{ 0 };
+		};
 
 		std::once_flag flag_;
-		std::tuple<const char*, const char*, const char*, const char*>args_;
-		std::mutex mtx_;
+		std::function<bool(DB&)> connect_;
+		pool_config config_;
+		std::unique_ptr<shard[]> shards_;
+		size_t shard_count_{ 1 };
+		size_t next_refill_{ 0 }; //只在维护线程中使用
+		std::atomic<long> idle_count_{ 0 }; //其他线程偷走时可能短暂为负
+		std::atomic<long> total_{ 0 };
+		std::atomic<int> waiters_{ 0 };
+		std::mutex wait_mtx_; //只有等待的线程才会用到
 		std::condition_variable cond_;
-		using ConnectionQueue = std::queue<std::shared_ptr<DB>>;
-		ConnectionQueue conq_;
+
+		std::thread maintainer_;
+		std::mutex maintain_mtx_;
+		std::condition_variable maintain_cond_;
+		std::atomic<bool> stop_{ false };
 	};
 }
 
-#endif //CONNECTION_POOL_H
\ No newline at end of file
+#endif //CONNECTION_POOL_H
@@ -0,0 +1,294 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include<coroutine>
+#include<optional>
+#include<exception>
+#include<utility>
+#include<vector>
+#include<mutex>
+#include<atomic>
+
+#ifdef __linux__
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<unistd.h>
+#endif
+
+namespace manjusaka {
+
+	template<typename T = void>
+	class task;
+
+	namespace detail {
+		//协程结束时切回等待它的协程，没有等待者时什么都不做
+		struct task_promise_base {
+			struct final_awaiter {
+				bool await_ready() noexcept { return false; }
+
+				template<typename P>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+					return h.promise().continuation_;
+				}
+
+				void await_resume() noexcept {}
+			};
+
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			final_awaiter final_suspend() noexcept { return {}; }
+			void unhandled_exception() { std::terminate(); }
+
+			std::coroutine_handle<> continuation_{ std::noop_coroutine() };
+		};
+
+		template<typename T>
+		struct task_promise : task_promise_base {
+			task<T> get_return_object();
+
+			template<typename U>
+			void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+
+			T result() { return std::move(*value_); }
+
+			std::optional<T> value_;
+		};
+
+		template<>
+		struct task_promise<void> : task_promise_base {
+			task<void> get_return_object();
+			void return_void() {}
+			void result() {}
+		};
+
+		//event_loop::spawn启动的协程，结束后自己销毁
+		struct detached_task {
+			struct promise_type {
+				detached_task get_return_object() { return {}; }
+				std::suspend_never initial_suspend() noexcept { return {}; }
+				std::suspend_never final_suspend() noexcept { return {}; }
+				void return_void() {}
+				void unhandled_exception() { std::terminate(); }
+			};
+		};
+	}
+
+	/*
+	* 惰性启动的协程，co_await时才开始执行，执行完后切回调用者
+	* 协程的参数要按值传递，调用者的临时变量在协程挂起后就失效了
+	*/
+	template<typename T>
+	class task {
+	public:
+		using promise_type = detail::task_promise<T>;
+		using handle_type = std::coroutine_handle<promise_type>;
+
+		explicit task(handle_type h) : h_(h) {}
+		task(task&& other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+
+		task& operator=(task&& other) noexcept {
+			if (this != &other) {
+				if (h_) {
+					h_.destroy();
+				}
+				h_ = std::exchange(other.h_, nullptr);
+			}
+			return *this;
+		}
+
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+
+		~task() {
+			if (h_) {
+				h_.destroy();
+			}
+		}
+
+		bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+			h_.promise().continuation_ = caller;
+			return h_;
+		}
+
+		T await_resume() { return h_.promise().result(); }
+
+	private:
+		handle_type h_;
+	};
+
+	namespace detail {
+		template<typename T>
+		inline task<T> task_promise<T>::get_return_object() {
+			return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+		}
+
+		inline task<void> task_promise<void>::get_return_object() {
+			return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+		}
+	}
+
+#ifdef __linux__
+
+	/*
+	* 基于epoll的单线程事件循环
+	* 每个连接只属于一个事件循环，多个线程各自运行一个事件循环就能驱动大量连接
+	* 除了post、spawn和stop以外的接口只能在运行run的线程中调用
+	*/
+	class event_loop {
+	public:
+		event_loop() {
+			epfd_ = epoll_create1(EPOLL_CLOEXEC);
+			wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			epoll_event ev{};
+			ev.events = EPOLLIN;
+			ev.data.ptr = nullptr; //nullptr表示唤醒事件
+			epoll_ctl(epfd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+		}
+
+		~event_loop() {
+			close(wake_fd_);
+			close(epfd_);
+		}
+
+		event_loop(const event_loop&) = delete;
+		event_loop& operator=(const event_loop&) = delete;
+
+		/*
+		* 加入事件循环的fd，由调用者保存，生存期要覆盖所有的等待
+		* 以边沿触发同时监听读写，注册一次之后不再修改：
+		*   写被阻塞(EAGAIN)后，发送缓冲区腾出空间时触发可写，数据没发完时不会错过
+		*   没有待发送的数据时socket一直可写也不会重复触发，等待读取时不会空转
+		* 没有协程在等待时到来的事件记在ready中，下一次等待直接返回
+		*/
+		struct io_source {
+			int fd{ -1 };
+			uint32_t ready{ 0 };
+			std::coroutine_handle<> waiter;
+		};
+
+		//等待source上的新事件，恢复时返回这期间触发的事件，注册失败返回0
+		struct io_awaiter {
+			bool await_ready() const noexcept { return failed_ || source_->ready != 0; }
+			void await_suspend(std::coroutine_handle<> h) noexcept { source_->waiter = h; }
+			uint32_t await_resume() const noexcept { return failed_ ? 0 : std::exchange(source_->ready, 0); }
+
+			io_source* source_;
+			bool failed_;
+		};
+
+		//fd和source中记录的不同时(第一次等待或者重连后socket变了)重新注册
+		io_awaiter wait_io(io_source& source, int fd) {
+			if (source.fd != fd) {
+				unregister(source);
+				epoll_event ev{};
+				ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+				ev.data.ptr = &source;
+				if (fd < 0 || epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+					return io_awaiter{ &source, true };
+				}
+				source.fd = fd;
+			}
+			return io_awaiter{ &source, false };
+		}
+
+		//关闭socket之前调用
+		void unregister(io_source& source) {
+			if (source.fd >= 0) {
+				epoll_ctl(epfd_, EPOLL_CTL_DEL, source.fd, nullptr);
+				source.fd = -1;
+			}
+			source.ready = 0;
+			source.waiter = nullptr;
+		}
+
+		//切换到事件循环的线程上继续执行
+		struct schedule_awaiter {
+			bool await_ready() const noexcept { return false; }
+			void await_suspend(std::coroutine_handle<> h) { loop_->post(h); }
+			void await_resume() const noexcept {}
+
+			event_loop* loop_;
+		};
+
+		schedule_awaiter schedule() { return schedule_awaiter{ this }; }
+
+		//可以在任意线程调用
+		void post(std::coroutine_handle<> h) {
+			{
+				std::lock_guard<std::mutex> lock(mtx_);
+				posted_.push_back(h);
+			}
+			wake();
+		}
+
+		//在事件循环中启动一个协程，不等待它的结果
+		template<typename T>
+		void spawn(task<T> t) {
+			start(this, std::move(t));
+		}
+
+		//运行到stop()被调用为止
+		void run() {
+			epoll_event events[64];
+			while (!stop_) {
+				run_posted();
+
+				int n = epoll_wait(epfd_, events, 64, -1);
+				for (int i = 0; i < n; i++) {
+					if (events[i].data.ptr == nullptr) {
+						uint64_t value;
+						while (read(wake_fd_, &value, sizeof(value)) > 0) {}
+						continue;
+					}
+
+					auto source = static_cast<io_source*>(events[i].data.ptr);
+					source->ready |= events[i].events;
+					if (source->waiter) {
+						std::exchange(source->waiter, nullptr).resume();
+					}
+				}
+			}
+			run_posted();
+		}
+
+		void stop() {
+			stop_ = true;
+			wake();
+		}
+
+	private:
+		template<typename T>
+		static detail::detached_task start(event_loop* loop, task<T> t) {
+			co_await loop->schedule();
+			co_await t;
+		}
+
+		void wake() {
+			uint64_t one = 1;
+			(void)write(wake_fd_, &one, sizeof(one));
+		}
+
+		void run_posted() {
+			std::vector<std::coroutine_handle<>> ready;
+			{
+				std::lock_guard<std::mutex> lock(mtx_);
+				ready.swap(posted_);
+			}
+
+			for (auto h : ready) {
+				h.resume();
+			}
+		}
+
+		int epfd_{ -1 };
+		int wake_fd_{ -1 };
+		std::atomic<bool> stop_{ false };
+		std::mutex mtx_;
+		std::vector<std::coroutine_handle<>> posted_;
+	};
+
+#endif //__linux__
+}
+
+#endif //EVENT_LOOP_H
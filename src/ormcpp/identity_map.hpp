@@ -0,0 +1,146 @@
+#ifndef IDENTITY_MAP_H
+#define IDENTITY_MAP_H
+
+#include<list>
+#include<mutex>
+#include<array>
+#include<atomic>
+#include<optional>
+#include<functional>
+#include<unordered_map>
+
+#include"reflection.hpp"
+#include"result_cache.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 按主键缓存单个对象，find_by_id和find_many先查这里，未命中的才去数据库
+	* 每种类型一份，所有连接共用，线程安全
+	* 对象记录放入时表的版本号，和result_cache共用版本号，写操作使表失效后旧对象不会再命中
+	* 容量为0时不缓存，默认关闭
+	*/
+	template<typename T>
+	class identity_map {
+	public:
+		using key_type = primary_key_t<T>;
+
+		static identity_map& instance() {
+			static identity_map instance;
+			return instance;
+		}
+
+		//最多缓存的对象个数，平均分到各个分片，设为0时关闭并清空
+		void set_capacity(size_t capacity) {
+			capacity_ = capacity;
+			if (capacity == 0) {
+				clear();
+			}
+		}
+
+		bool enabled() const { return capacity_ > 0; }
+
+		//查询前取版本号，和结果一起放进来
+		uint64_t version() const {
+			return result_cache::instance().version(T::TABLE_NAME());
+		}
+
+		std::optional<T> get(const key_type& key) {
+			shard& s = shard_of(key);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			auto it = s.map.find(key);
+			if (it == s.map.end()) {
+				misses_++;
+				return std::nullopt;
+			}
+
+			if (it->second->version != version()) {
+				s.lru.erase(it->second);
+				s.map.erase(it);
+				misses_++;
+				return std::nullopt;
+			}
+
+			hits_++;
+			s.lru.splice(s.lru.begin(), s.lru, it->second);
+			return it->second->value;
+		}
+
+		void put(const T& value, uint64_t version) {
+			size_t limit = (capacity_ + shard_count - 1) / shard_count;
+			if (limit == 0) {
+				return;
+			}
+
+			const key_type& key = get_primary_key(value);
+			shard& s = shard_of(key);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			auto it = s.map.find(key);
+			if (it != s.map.end()) {
+				it->second->value = value;
+				it->second->version = version;
+				s.lru.splice(s.lru.begin(), s.lru, it->second);
+				return;
+			}
+
+			while (!s.lru.empty() && s.lru.size() >= limit) {
+				s.map.erase(get_primary_key(s.lru.back().value));
+				s.lru.pop_back();
+			}
+
+			s.lru.push_front(entry{ value, version });
+			s.map.emplace(key, s.lru.begin());
+		}
+
+		void erase(const key_type& key) {
+			shard& s = shard_of(key);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			auto it = s.map.find(key);
+			if (it != s.map.end()) {
+				s.lru.erase(it->second);
+				s.map.erase(it);
+			}
+		}
+
+		void clear() {
+			for (auto& s : shards_) {
+				std::lock_guard<std::mutex> lock(s.mtx);
+				s.lru.clear();
+				s.map.clear();
+			}
+		}
+
+		size_t hits() const { return hits_; }
+		size_t misses() const { return misses_; }
+
+	private:
+		identity_map() = default;
+		identity_map(const identity_map&) = delete;
+		identity_map& operator=(const identity_map&) = delete;
+
+		struct entry {
+			T value;
+			uint64_t version;
+		};
+
+		//每个分片独占一条缓存行，避免伪共享
+		struct alignas(64) shard {
+			std::mutex mtx;
+			std::list<entry> lru;
+			std::unordered_map<key_type, typename std::list<entry>::iterator> map;
+		};
+
+		shard& shard_of(const key_type& key) {
+			return shards_[std::hash<key_type>{}(key) % shard_count];
+		}
+
+		static constexpr size_t shard_count = 16;
+
+		std::array<shard, shard_count> shards_;
+		std::atomic<size_t> capacity_{ 0 };
+		std::atomic<size_t> hits_{ 0 };
+		std::atomic<size_t> misses_{ 0 };
+	};
+}
+
+#endif //IDENTITY_MAP_H
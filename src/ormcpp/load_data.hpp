@@ -0,0 +1,136 @@
+#ifndef LOAD_DATA_H
+#define LOAD_DATA_H
+
+#include<string>
+#include<string.h>
+#include<charconv>
+#include<algorithm>
+#include<type_traits>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+    /*
+     * 按LOAD DATA默认格式转义：
+     * fields terminated by '\t' escaped by '\\' lines terminated by '\n'
+     * */
+    inline void append_tsv_escaped(std::string& out, const char* data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            char c = data[i];
+            switch (c) {
+            case '\\': out += "\\\\"; break;
+            case '\t': out += "\\t"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\0': out += "\\0"; break;
+            default: out += c; break;
+            }
+        }
+    }
+
+    template<typename T>
+    inline void append_tsv_field(std::string& out, const T& value) {
+        using U = std::remove_const_t<std::remove_reference_t<T>>;
+        if constexpr (is_optional_v<U>) {
+            if (value.has_value()) {
+                append_tsv_field(out, *value);
+            }
+            else {
+                out += "\\N";
+            }
+        }
+        else if constexpr (std::is_same_v<bool, U>) {
+            out += value ? '1' : '0';
+        }
+        else if constexpr (std::is_arithmetic_v<U>) {
+            //to_chars输出的浮点数可以无损往返
+            char buf[32];
+            std::to_chars_result r;
+            if constexpr (std::is_floating_point_v<U>) {
+                r = std::to_chars(buf, buf + sizeof(buf), value);
+            }
+            else if constexpr (std::is_signed_v<U>) {
+                r = std::to_chars(buf, buf + sizeof(buf), (long long)value);
+            }
+            else {
+                r = std::to_chars(buf, buf + sizeof(buf), (unsigned long long)value);
+            }
+            out.append(buf, r.ptr);
+        }
+        else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<blob, U>) {
+            append_tsv_escaped(out, value.data(), value.size());
+        }
+        else if constexpr (is_char_std_array_v<U>) { //VARCHAR(N)，以第一个'\0'为结尾
+            append_tsv_escaped(out, value.data(), strnlen(value.data(), value.size()));
+        }
+        else if constexpr (is_char_array_v<U>) {
+            append_tsv_escaped(out, value, strnlen(value, sizeof(U)));
+        }
+        else if constexpr (std::is_same_v<const char*, U>) {
+            append_tsv_escaped(out, value, strlen(value));
+        }
+        else {
+            static_assert(sizeof(U) == 0, "type is not supported by bulk_load");
+        }
+    }
+
+    template<typename T>
+    inline void append_tsv_row(std::string& out, const T& t) {
+        bool first = true;
+        forEach(t, [&](auto&& fieldName, auto&& value) {
+            if (!first) {
+                out += '\t';
+            }
+            first = false;
+            append_tsv_field(out, value);
+        });
+        out += '\n';
+    }
+
+    //local infile回调读取数据的接口
+    struct infile_reader {
+        virtual ~infile_reader() = default;
+        virtual int read(char* buf, unsigned int len) = 0;
+    };
+
+    /*
+     * 把[first, last)中的对象逐行序列化后交给mysql_set_local_infile_handler
+     * 任何时刻只缓存一行，内存占用和行数无关
+     * */
+    template<typename Iter>
+    class tsv_reader : public infile_reader {
+    public:
+        tsv_reader(Iter first, Iter last) : first_(first), last_(last) {}
+
+        int read(char* buf, unsigned int len) override {
+            size_t n = 0;
+            while (n < len) {
+                if (pos_ == line_.size()) {
+                    if (first_ == last_) {
+                        break;
+                    }
+                    line_.clear();
+                    pos_ = 0;
+                    append_tsv_row(line_, *first_);
+                    ++first_;
+                }
+
+                size_t count = (std::min)((size_t)len - n, line_.size() - pos_);
+                memcpy(buf + n, line_.data() + pos_, count);
+                n += count;
+                pos_ += count;
+            }
+            return (int)n;
+        }
+
+    private:
+        Iter first_;
+        Iter last_;
+        std::string line_;
+        size_t pos_{ 0 };
+    };
+}
+
+#endif //LOAD_DATA_H
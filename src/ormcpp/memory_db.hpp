@@ -0,0 +1,1682 @@
+#ifndef MEMORY_DB_H
+#define MEMORY_DB_H
+
+#include<map>
+#include<mutex>
+#include<shared_mutex>
+#include<memory>
+#include<string>
+#include<string_view>
+#include<vector>
+#include<optional>
+#include<functional>
+#include<unordered_map>
+#include<algorithm>
+#include<chrono>
+#include<charconv>
+#include<ctype.h>
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"reflection.hpp"
+#include"operation.hpp"
+#include"type_mapping.hpp"
+#include"text_protocol.hpp"
+#include"column_set.hpp"
+#include"result_set.hpp"
+#include"mysql.hpp"
+
+namespace manjusaka {
+
+	namespace detail {
+		//条件中的常量或者绑定的参数，数值也按文本保存，比较时按字段类型转换
+		struct memory_literal {
+			std::string text;
+			bool null{ false };
+		};
+
+		enum class memory_op { eq, ne, lt, le, gt, ge, is_null, not_null, in };
+
+		struct memory_term {
+			size_t field;
+			memory_op op;
+			std::vector<memory_literal> values;
+		};
+
+		//解析后的条件：多个term用and连接，然后排序、跳过offset行、最多limit行
+		struct memory_query {
+			std::vector<memory_term> terms;
+			std::vector<std::pair<size_t, bool>> order; //字段下标，是否降序
+			size_t offset{ 0 };
+			size_t limit{ (size_t)-1 };
+		};
+
+		struct memory_token {
+			enum kind_t { word, number, text, symbol, placeholder } kind;
+			std::string value;
+		};
+
+		//select的结果，每一列按文本保存，和文本协议的结果一样交给set_text_value转换
+		using memory_text_row = std::vector<memory_literal>;
+	}
+
+	struct memory_table_base;
+
+	//一个事务对一张表的undo日志，回滚时按相反的顺序恢复
+	struct memory_undo_base {
+		explicit memory_undo_base(memory_table_base* table) : table(table) {}
+		virtual ~memory_undo_base() = default;
+
+		//自己加表的写锁
+		virtual void rollback() = 0;
+
+		memory_table_base* table;
+	};
+
+	//表的公共部分，execute和事务回滚只知道表名，通过这里操作
+	struct memory_table_base {
+		virtual ~memory_table_base() = default;
+
+		virtual std::unique_ptr<memory_undo_base> make_undo() = 0;
+
+		//调用时持有mtx的写锁，undo不为空时删除的行移到undo日志中
+		virtual void clear_locked(memory_undo_base* undo = nullptr) = 0;
+
+		/*
+		* 执行select columns from 表 condition，只知道表名的tuple查询通过这里进行
+		* columns和condition是tokenize的结果，自己加读锁，出错时返回false
+		*/
+		virtual bool select_text(const std::vector<detail::memory_token>& columns,
+			std::vector<detail::memory_token> condition, const std::vector<detail::memory_literal>& params,
+			std::vector<detail::memory_text_row>& rows, std::string& error) = 0;
+
+		mutable std::shared_mutex mtx;
+	};
+
+	template<typename T>
+	struct memory_table;
+
+	/*
+	* 每修改一行记录一条：主键和修改前的值，新插入的行没有旧值，回滚时删除
+	* 只记录本事务改过的行，事务期间其他连接对别的行的修改不受回滚影响
+	*/
+	template<typename T>
+	struct memory_undo : memory_undo_base {
+		using key_type = primary_key_t<T>;
+
+		explicit memory_undo(memory_table<T>* table) : memory_undo_base(table) {}
+
+		void rollback() override;
+
+		std::vector<std::pair<key_type, std::optional<T>>> rows;
+	};
+
+	//一张表，行按主键排序保存，和InnoDB按主键顺序返回的结果一致
+	template<typename T>
+	struct memory_table : memory_table_base {
+		using key_type = primary_key_t<T>;
+
+		std::unique_ptr<memory_undo_base> make_undo() override {
+			return std::make_unique<memory_undo<T>>(this);
+		}
+
+		void clear_locked(memory_undo_base* undo = nullptr) override {
+			if (undo != nullptr) {
+				auto& log = static_cast<memory_undo<T>&>(*undo).rows;
+				for (auto& [key, row] : rows) {
+					log.emplace_back(key, std::move(row));
+				}
+			}
+			rows.clear();
+		}
+
+		bool select_text(const std::vector<detail::memory_token>& columns,
+			std::vector<detail::memory_token> condition, const std::vector<detail::memory_literal>& params,
+			std::vector<detail::memory_text_row>& rows, std::string& error) override;
+
+		std::map<key_type, T> rows;
+	};
+
+	template<typename T>
+	inline void memory_undo<T>::rollback() {
+		auto& t = static_cast<memory_table<T>&>(*table);
+		std::unique_lock<std::shared_mutex> lock(t.mtx);
+		for (auto it = rows.rbegin(); it != rows.rend(); ++it) {
+			if (it->second) {
+				t.rows.insert_or_assign(it->first, std::move(*it->second));
+			}
+			else {
+				t.rows.erase(it->first);
+			}
+		}
+	}
+
+	/*
+	* 内存中的数据库，同一个store上的所有连接看到相同的数据
+	* 表在第一次访问时创建，按DEFINE_TABLE中的表名区分，创建后不会删除
+	*/
+	class memory_store {
+	public:
+		memory_store() = default;
+		memory_store(const memory_store&) = delete;
+		memory_store& operator=(const memory_store&) = delete;
+
+		//按名字区分的全局store，connect时的database参数就是这里的name
+		static memory_store& instance(const std::string& name = "") {
+			static std::mutex mtx;
+			static std::unordered_map<std::string, std::unique_ptr<memory_store>> stores;
+			std::lock_guard<std::mutex> lock(mtx);
+			auto& store = stores[name];
+			if (!store) {
+				store = std::make_unique<memory_store>();
+			}
+			return *store;
+		}
+
+		//同一个表名已经被其他类型使用时返回nullptr
+		template<typename T>
+		memory_table<T>* table() {
+			std::lock_guard<std::mutex> lock(mtx_);
+			auto& t = tables_[T::TABLE_NAME()];
+			if (!t) {
+				t = std::make_unique<memory_table<T>>();
+			}
+			return dynamic_cast<memory_table<T>*>(t.get());
+		}
+
+		//表名不区分大小写，没有创建过时返回nullptr
+		memory_table_base* find(std::string_view name) {
+			std::lock_guard<std::mutex> lock(mtx_);
+			for (auto& [key, t] : tables_) {
+				if (key.size() == name.size() && std::equal(key.begin(), key.end(), name.begin(),
+					[](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); })) {
+					return t.get();
+				}
+			}
+			return nullptr;
+		}
+
+		//清空所有表的数据
+		void clear() {
+			std::lock_guard<std::mutex> lock(mtx_);
+			for (auto& [key, t] : tables_) {
+				std::unique_lock<std::shared_mutex> table_lock(t->mtx);
+				t->clear_locked();
+			}
+		}
+
+	private:
+		std::mutex mtx_;
+		std::unordered_map<std::string, std::unique_ptr<memory_table_base>> tables_;
+	};
+
+	namespace detail {
+		inline bool iequals(std::string_view a, std::string_view b) {
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+				[](char x, char y) { return tolower((unsigned char)x) == tolower((unsigned char)y); });
+		}
+
+		inline bool tokenize(std::string_view sql, std::vector<memory_token>& tokens, std::string& error) {
+			size_t i = 0;
+			while (i < sql.size()) {
+				char c = sql[i];
+				if (isspace((unsigned char)c) || c == ';') {
+					i++;
+				}
+				else if (isalpha((unsigned char)c) || c == '_' || c == '`') {
+					std::string word;
+					while (i < sql.size() && (isalnum((unsigned char)sql[i]) || sql[i] == '_' ||
+						sql[i] == '`' || sql[i] == '.')) {
+						if (sql[i] == '.') { //table.field只保留field
+							word.clear();
+						}
+						else if (sql[i] != '`') {
+							word += sql[i];
+						}
+						i++;
+					}
+					tokens.push_back({ memory_token::word, std::move(word) });
+				}
+				else if (isdigit((unsigned char)c) || ((c == '-' || c == '.') && i + 1 < sql.size() &&
+					isdigit((unsigned char)sql[i + 1]))) {
+					size_t start = i++;
+					while (i < sql.size() && (isalnum((unsigned char)sql[i]) || sql[i] == '.' ||
+						((sql[i] == '-' || sql[i] == '+') && (sql[i - 1] == 'e' || sql[i - 1] == 'E')))) {
+						i++;
+					}
+					tokens.push_back({ memory_token::number, std::string(sql.substr(start, i - start)) });
+				}
+				else if (c == '\'' || c == '"') {
+					std::string text;
+					i++;
+					while (true) {
+						if (i >= sql.size()) {
+							error = "unterminated string";
+							return false;
+						}
+						if (sql[i] == '\\' && i + 1 < sql.size()) {
+							text += sql[i + 1];
+							i += 2;
+						}
+						else if (sql[i] == c) {
+							if (i + 1 < sql.size() && sql[i + 1] == c) { //''转义
+								text += c;
+								i += 2;
+							}
+							else {
+								i++;
+								break;
+							}
+						}
+						else {
+							text += sql[i++];
+						}
+					}
+					tokens.push_back({ memory_token::text, std::move(text) });
+				}
+				else if (c == '?') {
+					tokens.push_back({ memory_token::placeholder, "?" });
+					i++;
+				}
+				else if (i + 1 < sql.size() && (sql.substr(i, 2) == "<=" || sql.substr(i, 2) == ">=" ||
+					sql.substr(i, 2) == "<>" || sql.substr(i, 2) == "!=")) {
+					tokens.push_back({ memory_token::symbol, std::string(sql.substr(i, 2)) });
+					i += 2;
+				}
+				else if (c == '=' || c == '<' || c == '>' || c == '(' || c == ')' || c == ',' || c == '*') {
+					tokens.push_back({ memory_token::symbol, std::string(1, c) });
+					i++;
+				}
+				else {
+					error = std::string("unexpected character '") + c + "'";
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//字段名和mysql一样不区分大小写
+		template<typename T>
+		inline size_t find_field(std::string_view name) {
+			for (size_t i = 0; i < T::field_count; i++) {
+				if (iequals(field_names_v<T>[i], name)) {
+					return i;
+				}
+			}
+			return T::field_count;
+		}
+
+		/*
+		* 只支持简单的条件：
+		* [where] field op value [and field op value ...] [order by field [asc|desc], ...] [limit [offset,] n]
+		* op为= != <> < <= > >=，以及is null、is not null、in (v1, v2, ...)
+		* 用and连接的条件可以放在括号中，例如parallel_query生成的"id >= 1 and id <= 9 and (age > 18)"
+		* value可以是数字、字符串、null或者?，?按顺序取params
+		*/
+		template<typename T>
+		class memory_parser {
+		public:
+			memory_parser(std::vector<memory_token> tokens, const std::vector<memory_literal>& params)
+				:tokens_(std::move(tokens)), params_(params) {}
+
+			bool parse(memory_query& q, std::string& error) {
+				if (accept_word("where")) {
+					parse_terms(q);
+				}
+
+				if (error_.empty() && accept_word("order")) {
+					if (!accept_word("by")) {
+						error_ = "expected by after order";
+					}
+					while (error_.empty()) {
+						size_t field = parse_field();
+						bool desc = accept_word("desc");
+						if (!desc) {
+							accept_word("asc");
+						}
+						q.order.emplace_back(field, desc);
+						if (!accept_symbol(",")) {
+							break;
+						}
+					}
+				}
+
+				if (error_.empty() && accept_word("limit")) {
+					q.limit = parse_count();
+					if (accept_symbol(",")) {
+						q.offset = q.limit;
+						q.limit = parse_count();
+					}
+					else if (accept_word("offset")) {
+						q.offset = parse_count();
+					}
+				}
+
+				if (error_.empty() && pos_ < tokens_.size()) {
+					error_ = iequals(tokens_[pos_].value, "or") ? "or is not supported" :
+						"unexpected '" + tokens_[pos_].value + "'";
+				}
+				if (error_.empty() && next_param_ != params_.size()) {
+					error_ = "placeholder count does not match the arguments";
+				}
+
+				error = error_;
+				return error_.empty();
+			}
+
+		private:
+			//只有and，括号中的条件直接展开
+			bool parse_terms(memory_query& q) {
+				do {
+					if (accept_symbol("(")) {
+						if (!parse_terms(q)) {
+							return false;
+						}
+						if (!accept_symbol(")")) {
+							error_ = pos_ < tokens_.size() && iequals(tokens_[pos_].value, "or") ?
+								"or is not supported" : "expected )";
+							return false;
+						}
+					}
+					else {
+						memory_term term;
+						if (!parse_term(term)) {
+							return false;
+						}
+						q.terms.push_back(std::move(term));
+					}
+				} while (accept_word("and"));
+				return true;
+			}
+
+			bool parse_term(memory_term& term) {
+				term.field = parse_field();
+				if (!error_.empty()) {
+					return false;
+				}
+
+				if (accept_word("is")) {
+					term.op = accept_word("not") ? memory_op::not_null : memory_op::is_null;
+					if (!accept_word("null")) {
+						error_ = "expected null after is";
+					}
+				}
+				else if (accept_word("in")) {
+					term.op = memory_op::in;
+					if (!accept_symbol("(")) {
+						error_ = "expected ( after in";
+						return false;
+					}
+					do {
+						term.values.push_back(parse_value());
+					} while (error_.empty() && accept_symbol(","));
+					if (error_.empty() && !accept_symbol(")")) {
+						error_ = "expected ) after in list";
+					}
+				}
+				else {
+					term.op = parse_op();
+					term.values.push_back(parse_value());
+				}
+				return error_.empty();
+			}
+
+			size_t parse_field() {
+				if (pos_ >= tokens_.size() || tokens_[pos_].kind != memory_token::word) {
+					error_ = "expected a field name";
+					return T::field_count;
+				}
+				size_t field = find_field<T>(tokens_[pos_].value);
+				if (field == T::field_count) {
+					error_ = "unknown field '" + tokens_[pos_].value + "'";
+				}
+				pos_++;
+				return field;
+			}
+
+			memory_op parse_op() {
+				static const std::pair<std::string_view, memory_op> ops[] = {
+					{ "=", memory_op::eq }, { "!=", memory_op::ne }, { "<>", memory_op::ne },
+					{ "<", memory_op::lt }, { "<=", memory_op::le }, { ">", memory_op::gt }, { ">=", memory_op::ge } };
+				for (auto& [symbol, op] : ops) {
+					if (accept_symbol(symbol)) {
+						return op;
+					}
+				}
+				error_ = "expected a comparison operator";
+				return memory_op::eq;
+			}
+
+			memory_literal parse_value() {
+				if (pos_ >= tokens_.size()) {
+					error_ = "expected a value";
+					return {};
+				}
+
+				const memory_token& token = tokens_[pos_++];
+				switch (token.kind) {
+				case memory_token::number:
+				case memory_token::text:
+					return { token.value, false };
+				case memory_token::placeholder:
+					if (next_param_ >= params_.size()) {
+						error_ = "placeholder count does not match the arguments";
+						return {};
+					}
+					return params_[next_param_++];
+				default:
+					if (iequals(token.value, "null")) {
+						return { "", true };
+					}
+					error_ = "unexpected '" + token.value + "'";
+					return {};
+				}
+			}
+
+			size_t parse_count() {
+				memory_literal value = parse_value();
+				if (value.null) {
+					error_ = "expected a number";
+					return 0;
+				}
+				return (size_t)strtoull(value.text.c_str(), nullptr, 10);
+			}
+
+			bool accept_word(std::string_view word) {
+				if (pos_ < tokens_.size() && tokens_[pos_].kind == memory_token::word &&
+					iequals(tokens_[pos_].value, word)) {
+					pos_++;
+					return true;
+				}
+				return false;
+			}
+
+			bool accept_symbol(std::string_view symbol) {
+				if (pos_ < tokens_.size() && tokens_[pos_].kind == memory_token::symbol &&
+					tokens_[pos_].value == symbol) {
+					pos_++;
+					return true;
+				}
+				return false;
+			}
+
+			std::vector<memory_token> tokens_;
+			const std::vector<memory_literal>& params_;
+			size_t pos_{ 0 };
+			size_t next_param_{ 0 };
+			std::string error_;
+		};
+
+		//字段按mysql的比较方式看成字符串时的内容，定长数组到第一个0为止
+		template<typename U>
+		inline std::string_view text_of(const U& value) {
+			if constexpr (is_char_array_v<U> || is_char_std_array_v<U>) {
+				const char* p = (const char*)&value;
+				return std::string_view(p, std::find(p, p + sizeof(U), '\0') - p);
+			}
+			else if constexpr (std::is_same_v<blob, U>) {
+				return std::string_view(value.data(), value.size());
+			}
+			else {
+				return value;
+			}
+		}
+
+		//绑定的参数或者字段的值转换成literal，规则和make_param_binds接受的类型一致
+		template<typename U>
+		inline memory_literal to_literal(const U& value) {
+			if constexpr (is_optional_v<U>) {
+				return value ? to_literal(*value) : memory_literal{ "", true };
+			}
+			else if constexpr (std::is_same_v<bool, U>) {
+				return { value ? "1" : "0", false };
+			}
+			else if constexpr (std::is_floating_point_v<U>) {
+				char buf[32];
+				snprintf(buf, sizeof(buf), "%.17g", (double)value);
+				return { buf, false };
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				return { std::to_string(value), false };
+			}
+			else {
+				return { std::string(text_of(value)), false };
+			}
+		}
+
+		template<typename V>
+		inline int three_way(const V& a, const V& b) {
+			return a < b ? -1 : (b < a ? 1 : 0);
+		}
+
+		//字段和常量比较，任意一边为NULL时返回空
+		template<typename U>
+		inline std::optional<int> compare_literal(const U& value, const memory_literal& literal) {
+			if constexpr (is_optional_v<U>) {
+				if (!value) {
+					return std::nullopt;
+				}
+				return compare_literal(*value, literal);
+			}
+			else {
+				if (literal.null) {
+					return std::nullopt;
+				}
+
+				if constexpr (std::is_arithmetic_v<U>) {
+					const char* begin = literal.text.data();
+					const char* end = begin + literal.text.size();
+					if constexpr (std::is_integral_v<U>) {
+						if constexpr (std::is_signed_v<U>) {
+							long long n;
+							auto r = std::from_chars(begin, end, n);
+							if (r.ec == std::errc() && r.ptr == end) {
+								return three_way((long long)value, n);
+							}
+						}
+						else {
+							unsigned long long n;
+							auto r = std::from_chars(begin, end, n);
+							if (r.ec == std::errc() && r.ptr == end) {
+								return three_way((unsigned long long)value, n);
+							}
+						}
+					}
+					return three_way((double)value, strtod(literal.text.c_str(), nullptr));
+				}
+				else {
+					std::string_view text = text_of(value);
+					return three_way(text, std::string_view(literal.text));
+				}
+			}
+		}
+
+		//两行同一字段比较，用于排序，NULL排在最前面
+		template<typename U>
+		inline int compare_values(const U& a, const U& b) {
+			if constexpr (is_optional_v<U>) {
+				if (!a || !b) {
+					return (bool)a - (bool)b;
+				}
+				return compare_values(*a, *b);
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				return three_way(a, b);
+			}
+			else {
+				return three_way(text_of(a), text_of(b));
+			}
+		}
+
+		template<size_t I, typename T>
+		inline const field_type_t<T, I>& field_at(const T& t) {
+			return typename T::template FIELD<const T, I>(t).value();
+		}
+
+		//按运行时的下标访问字段，f的参数是字段的引用
+		template<typename T, typename F, size_t... Is>
+		inline void visit_field(const T& t, size_t i, F&& f, std::index_sequence<Is...>) {
+			((i == Is ? (f(field_at<Is>(t)), 0) : 0), ...);
+		}
+
+		template<typename T, typename F>
+		inline void visit_field(const T& t, size_t i, F&& f) {
+			visit_field(t, i, std::forward<F>(f), std::make_index_sequence<T::field_count>{});
+		}
+
+		//optional为空时不调用f，否则用里面的值调用
+		template<typename U, typename F>
+		inline void visit_present(const U& value, F&& f) {
+			if constexpr (is_optional_v<U>) {
+				if (value) {
+					f(*value);
+				}
+			}
+			else {
+				f(value);
+			}
+		}
+
+		template<typename T>
+		inline bool field_is_null(const T& t, size_t i) {
+			bool null = true;
+			visit_field(t, i, [&](const auto& value) { visit_present(value, [&](const auto&) { null = false; }); });
+			return null;
+		}
+
+		template<typename T>
+		inline memory_literal field_literal(const T& t, size_t i) {
+			memory_literal literal;
+			visit_field(t, i, [&](const auto& value) { literal = to_literal(value); });
+			return literal;
+		}
+
+		/*
+		* 把一行包装成和result_binder相同的接口，column_set和result_set按字段下标读取
+		* NULL时数值为0，字符串为空
+		*/
+		template<typename T>
+		struct memory_row_reader {
+			bool is_null(size_t field) const { return field_is_null(*row, field); }
+
+			template<typename U>
+			U scalar(size_t field) const {
+				U result{};
+				visit_field(*row, field, [&](const auto& value) {
+					visit_present(value, [&](const auto& v) {
+						if constexpr (std::is_arithmetic_v<std::decay_t<decltype(v)>>) {
+							result = (U)v;
+						}
+					});
+				});
+				return result;
+			}
+
+			std::string_view column(size_t field) const {
+				std::string_view result;
+				visit_field(*row, field, [&](const auto& value) {
+					visit_present(value, [&](const auto& v) {
+						if constexpr (!std::is_arithmetic_v<std::decay_t<decltype(v)>>) {
+							result = text_of(v);
+						}
+					});
+				});
+				return result;
+			}
+
+			const T* row;
+		};
+
+		template<typename T, size_t... Is>
+		inline int compare_field(const T& a, const T& b, size_t i, std::index_sequence<Is...>) {
+			int r = 0;
+			((i == Is ? (r = compare_values(field_at<Is>(a), field_at<Is>(b)), 0) : 0), ...);
+			return r;
+		}
+
+		template<typename T, size_t... Is>
+		inline bool same_row(const T& a, const T& b, std::index_sequence<Is...>) {
+			return ((compare_values(field_at<Is>(a), field_at<Is>(b)) == 0) && ...);
+		}
+
+		template<typename T>
+		inline bool matches(const T& t, const memory_term& term) {
+			bool result = false;
+			visit_field(t, term.field, [&](const auto& value) {
+				using U = std::decay_t<decltype(value)>;
+				if (term.op == memory_op::is_null || term.op == memory_op::not_null) {
+					bool null = false;
+					if constexpr (is_optional_v<U>) {
+						null = !value.has_value();
+					}
+					result = null == (term.op == memory_op::is_null);
+					return;
+				}
+
+				for (auto& literal : term.values) {
+					auto r = compare_literal(value, literal);
+					if (!r) {
+						continue;
+					}
+					switch (term.op) {
+					case memory_op::eq:
+					case memory_op::in: result = *r == 0; break;
+					case memory_op::ne: result = *r != 0; break;
+					case memory_op::lt: result = *r < 0; break;
+					case memory_op::le: result = *r <= 0; break;
+					case memory_op::gt: result = *r > 0; break;
+					case memory_op::ge: result = *r >= 0; break;
+					default: break;
+					}
+					if (result) {
+						return;
+					}
+				}
+			});
+			return result;
+		}
+
+		template<typename T>
+		inline bool matches(const T& t, const memory_query& q) {
+			for (auto& term : q.terms) {
+				if (!matches(t, term)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		/*
+		* 按条件选出行，调用时持有表的锁
+		* 没有order by时按主键顺序，遇到limit就停止扫描
+		*/
+		template<typename T>
+		inline std::vector<const T*> select_rows(const memory_table<T>& table, const memory_query& q) {
+			std::vector<const T*> rows;
+			size_t skipped = 0;
+			for (auto& [key, row] : table.rows) {
+				if (!matches(row, q)) {
+					continue;
+				}
+				if (q.order.empty()) {
+					if (skipped < q.offset) {
+						skipped++;
+						continue;
+					}
+					if (rows.size() >= q.limit) {
+						break;
+					}
+				}
+				rows.push_back(&row);
+			}
+
+			if (!q.order.empty()) {
+				std::stable_sort(rows.begin(), rows.end(), [&](const T* a, const T* b) {
+					for (auto& [field, desc] : q.order) {
+						int r = compare_field(*a, *b, field, std::make_index_sequence<T::field_count>{});
+						if (r != 0) {
+							return desc ? r > 0 : r < 0;
+						}
+					}
+					return false;
+				});
+				size_t begin = (std::min)(q.offset, rows.size());
+				size_t end = begin + (std::min)(q.limit, rows.size() - begin);
+				rows = std::vector<const T*>(rows.begin() + begin, rows.begin() + end);
+			}
+			return rows;
+		}
+
+		//select后面的一列，count(*)的field为T::field_count
+		struct memory_column {
+			enum kind_t { plain, min, max, count } kind;
+			size_t field;
+		};
+
+		/*
+		* 只支持 * 、字段名和min(field)、max(field)、count(*)、count(field)
+		* 聚合函数和普通字段不能混用，没有group by
+		*/
+		template<typename T>
+		inline bool parse_columns(const std::vector<memory_token>& tokens, std::vector<memory_column>& columns,
+			std::string& error) {
+			auto symbol = [&](size_t i, std::string_view s) {
+				return i < tokens.size() && tokens[i].kind == memory_token::symbol && tokens[i].value == s;
+			};
+			auto field = [&](size_t i) {
+				return i < tokens.size() && tokens[i].kind == memory_token::word ?
+					find_field<T>(tokens[i].value) : T::field_count;
+			};
+
+			size_t i = 0;
+			while (true) {
+				if (symbol(i, "*")) {
+					for (size_t f = 0; f < T::field_count; f++) {
+						columns.push_back({ memory_column::plain, f });
+					}
+					i++;
+				}
+				else if (symbol(i + 1, "(")) {
+					const std::string& name = tokens[i].value;
+					memory_column column{ memory_column::count, field(i + 2) };
+					if (iequals(name, "min")) {
+						column.kind = memory_column::min;
+					}
+					else if (iequals(name, "max")) {
+						column.kind = memory_column::max;
+					}
+					else if (!iequals(name, "count")) {
+						error = "function " + name + " is not supported";
+						return false;
+					}
+
+					bool all = column.kind == memory_column::count && symbol(i + 2, "*");
+					if ((column.field == T::field_count && !all) || !symbol(i + 3, ")")) {
+						error = "unsupported argument of " + name;
+						return false;
+					}
+					columns.push_back(column);
+					i += 4;
+				}
+				else {
+					size_t f = field(i);
+					if (f == T::field_count) {
+						error = i < tokens.size() ? "unknown field '" + tokens[i].value + "'" : "expected a field name";
+						return false;
+					}
+					columns.push_back({ memory_column::plain, f });
+					i++;
+				}
+
+				if (i == tokens.size()) {
+					break;
+				}
+				if (!symbol(i++, ",")) {
+					error = "unexpected '" + tokens[i - 1].value + "'";
+					return false;
+				}
+			}
+
+			bool aggregate = columns.front().kind != memory_column::plain;
+			for (auto& column : columns) {
+				if ((column.kind != memory_column::plain) != aggregate) {
+					error = "mixing aggregates and fields is not supported";
+					return false;
+				}
+			}
+			return true;
+		}
+
+		//聚合函数的结果只有一行，min和max忽略NULL，没有值时为NULL
+		template<typename T>
+		inline memory_text_row aggregate_rows(const std::vector<const T*>& rows,
+			const std::vector<memory_column>& columns) {
+			memory_text_row result;
+			for (auto& column : columns) {
+				if (column.kind == memory_column::count) {
+					size_t n = 0;
+					for (auto row : rows) {
+						n += column.field == T::field_count || !field_is_null(*row, column.field);
+					}
+					result.push_back({ std::to_string(n), false });
+					continue;
+				}
+
+				const T* best = nullptr;
+				for (auto row : rows) {
+					if (field_is_null(*row, column.field)) {
+						continue;
+					}
+					int r = best == nullptr ? 0 :
+						compare_field(*row, *best, column.field, std::make_index_sequence<T::field_count>{});
+					if (best == nullptr || (column.kind == memory_column::min ? r < 0 : r > 0)) {
+						best = row;
+					}
+				}
+				result.push_back(best ? field_literal(*best, column.field) : memory_literal{ "", true });
+			}
+			return result;
+		}
+	}
+
+	template<typename T>
+	inline bool memory_table<T>::select_text(const std::vector<detail::memory_token>& columns,
+		std::vector<detail::memory_token> condition, const std::vector<detail::memory_literal>& params,
+		std::vector<detail::memory_text_row>& result, std::string& error) {
+		std::vector<detail::memory_column> list;
+		detail::memory_query q;
+		if (!detail::parse_columns<T>(columns, list, error) ||
+			!detail::memory_parser<T>(std::move(condition), params).parse(q, error)) {
+			return false;
+		}
+
+		std::shared_lock<std::shared_mutex> lock(mtx);
+		auto selected = detail::select_rows(*this, q);
+		if (list.front().kind != detail::memory_column::plain) {
+			result.push_back(detail::aggregate_rows(selected, list));
+			return true;
+		}
+
+		result.reserve(selected.size());
+		for (auto row : selected) {
+			detail::memory_text_row& text = result.emplace_back();
+			for (auto& column : list) {
+				text.push_back(detail::field_literal(*row, column.field));
+			}
+		}
+		return true;
+	}
+
+	/*
+	* 进程内的数据库，接口和mysql相同，可以作为connection_pool<DB>的DB
+	* 数据以反射对象的形式按主键保存在memory_store中，没有网络和序列化，结果是确定的
+	* 用来在没有mysqld时测试和压测连接池、反射、物化等ORM自身的开销
+	*
+	* 和mysql的区别：
+	* 1.条件只支持memory_parser中的简单语法，不支持的条件返回出错，last_error()给出原因
+	*   tuple版本的query只支持select 字段或min/max/count from 表 [条件]，游标先复制出全部结果
+	* 2.主键唯一，重复时插入失败；没有其他约束和索引，条件查询都是全表扫描
+	* 3.事务没有隔离，其他连接能看到未提交的修改；回滚按undo日志逐行恢复本事务改过的行
+	* 4.execute只认识begin、commit、rollback、create、truncate、drop和不带条件的delete from
+	*   和mysql一样，create、truncate、drop先隐式提交当前的事务，之后不能回滚
+	*
+	* manjusaka::connection_pool<manjusaka::memory_db> pool;
+	* pool.init(4, "", "", "", "test");  //和mysql相同的参数，database选择memory_store
+	*/
+	class memory_db {
+	public:
+		memory_db() = default;
+		~memory_db() { disconnect(); }
+		memory_db(const memory_db&) = delete;
+		memory_db& operator=(const memory_db&) = delete;
+
+		/*
+		* connect()使用默认的store
+		* connect(memory_store*)或connect(memory_store&)使用指定的store
+		* connect(ip, user, pwd, db, ...)和mysql参数相同，按db选择store，其他参数忽略
+		*/
+		template<typename... Args>
+		bool connect(Args &&...args) {
+			disconnect();
+			store_ = &select_store(std::forward<Args>(args)...);
+			refreshAliveTime();
+			return true;
+		}
+
+		bool disconnect() {
+			if (in_transaction_) {
+				rollback();
+			}
+			store_ = nullptr;
+			return true;
+		}
+
+		bool ping() { return store_ != nullptr; }
+
+		memory_store* store() const { return store_; }
+
+		const std::string& last_error() const { return error_; }
+
+		//返回插入成功数据的个数，主键重复返回-1
+		template<typename T>
+		int insert(const T& t) {
+			auto table = begin_write<T>();
+			if (!table) {
+				return -1;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			if (!table->rows.try_emplace(get_primary_key(t), t).second) {
+				error_ = "duplicate primary key";
+				return -1;
+			}
+			save_insert(*table, get_primary_key(t));
+			return 1;
+		}
+
+		//全部成功或者全部不插入
+		template<typename T>
+		int insert(const std::vector<T>& t) {
+			auto table = begin_write<T>();
+			if (!table) {
+				return -1;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			for (size_t i = 0; i < t.size(); i++) {
+				if (!table->rows.try_emplace(get_primary_key(t[i]), t[i]).second) {
+					for (size_t j = 0; j < i; j++) {
+						table->rows.erase(get_primary_key(t[j]));
+					}
+					error_ = "duplicate primary key";
+					return -1;
+				}
+			}
+			for (auto& row : t) {
+				save_insert(*table, get_primary_key(row));
+			}
+			return (int)t.size();
+		}
+
+		//影响行数的算法和mysql相同：新插入的行算1，更新的行算2，值没变的行算0
+		template<typename T>
+		int upsert(const std::vector<T>& t) {
+			auto table = begin_write<T>();
+			if (!table) {
+				return -1;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			int affected = 0;
+			for (auto& row : t) {
+				auto [it, inserted] = table->rows.try_emplace(get_primary_key(row), row);
+				if (inserted) {
+					save_insert(*table, it->first);
+					affected += 1;
+				}
+				else if (!detail::same_row(it->second, row, std::make_index_sequence<T::field_count>{})) {
+					save_undo(*table, it->first, it->second);
+					it->second = row;
+					affected += 2;
+				}
+			}
+			return affected;
+		}
+
+		//按key_field更新其他字段，返回影响的行数(值没有变化时为0)，出错返回-1
+		template<typename T>
+		int update(const T& t, std::string_view key_field) {
+			const size_t key = field_index<T>(key_field);
+			if (key == T::field_count || T::field_count < 2) {
+				error_ = "unknown key field";
+				return -1;
+			}
+
+			auto table = begin_write<T>();
+			if (!table) {
+				return -1;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			std::vector<primary_key_t<T>> keys;
+			for (auto& [k, row] : table->rows) {
+				if (detail::compare_field(row, t, key, std::make_index_sequence<T::field_count>{}) == 0) {
+					keys.push_back(k);
+				}
+			}
+
+			if (keys.empty()) {
+				return 0;
+			}
+
+			//其他字段包括主键都设置成t的值，匹配多行时主键必然重复
+			auto& new_key = get_primary_key(t);
+			if (keys.size() > 1 || (keys.front() != new_key && table->rows.count(new_key) != 0)) {
+				error_ = "duplicate primary key";
+				return -1;
+			}
+
+			auto it = table->rows.find(keys.front());
+			if (detail::same_row(it->second, t, std::make_index_sequence<T::field_count>{})) {
+				return 0;
+			}
+			if (keys.front() == new_key) {
+				save_undo(*table, it->first, it->second);
+				it->second = t;
+			}
+			else {
+				save_undo(*table, it->first, std::move(it->second));
+				table->rows.erase(it);
+				table->rows.emplace(new_key, t);
+				save_insert(*table, new_key);
+			}
+			return 1;
+		}
+
+		template<typename T>
+		int update(const T& t) {
+			return update(t, field_names_v<T>[primary_key_index_v<T>]);
+		}
+
+		template<typename T>
+		std::optional<T> find_by_id(const primary_key_t<T>& key) {
+			auto table = table_of<T>();
+			if (!table) {
+				return std::nullopt;
+			}
+
+			std::shared_lock<std::shared_mutex> lock(table->mtx);
+			auto it = table->rows.find(key);
+			if (it == table->rows.end()) {
+				return std::nullopt;
+			}
+			return it->second;
+		}
+
+		//结果按主键排序，不存在的主键没有对应的对象
+		template<typename T>
+		std::vector<T> find_many(const std::vector<primary_key_t<T>>& keys) {
+			auto table = table_of<T>();
+			if (!table) {
+				return {};
+			}
+
+			std::vector<primary_key_t<T>> sorted = keys;
+			std::sort(sorted.begin(), sorted.end());
+			sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+			std::vector<T> v;
+			std::shared_lock<std::shared_mutex> lock(table->mtx);
+			for (auto& key : sorted) {
+				auto it = table->rows.find(key);
+				if (it != table->rows.end()) {
+					v.push_back(it->second);
+				}
+			}
+			return v;
+		}
+
+		//批量导入，和insert(vector)相同，返回导入的行数，失败返回-1
+		template<typename T, typename Range>
+		long long bulk_load(const Range& range) {
+			return insert(std::vector<T>(std::begin(range), std::end(range)));
+		}
+
+		//条件的写法和mysql相同，query<Person>("where age > 18 order by id")
+		template<typename T, typename... Args>
+		std::enable_if_t<is_reflection_v<T> && !is_where_first_v<Args...>, std::vector<T>> query(Args &&...args) {
+			std::string condition = "";
+			append(condition, std::forward<Args>(args)...);
+			return select<T>(condition, {});
+		}
+
+		//query<Person>(manjusaka::where("age > ? and name = ?"), 18, "JOJO")
+		template<typename T, typename... Args>
+		std::enable_if_t<is_reflection_v<T>, std::vector<T>> query(const where_condition& condition,
+			const Args&... args) {
+			return select<T>(condition.sql, { detail::to_literal(args)... });
+		}
+
+		/*
+		* 指定字段版本，返回tuple，sql中的?按顺序绑定args
+		* 只支持select 字段或min/max/count from 表 [条件]，query<std::tuple<int, std::string>>("select id, name from Person")
+		*/
+		template<typename T, typename... Args>
+		std::enable_if_t<!is_reflection_v<T>, std::vector<T>> query(const std::string& sql, const Args&... args) {
+			static_assert(is_tuple_v<T>);
+			std::vector<T> v;
+			select_tuples<T>(sql, { detail::to_literal(args)... }, v);
+			return v;
+		}
+
+		//任意谓词，只在内存后端上可用
+		template<typename T, typename F>
+		std::vector<T> query_if(F&& f) {
+			std::vector<T> v;
+			auto table = table_of<T>();
+			if (!table) {
+				return v;
+			}
+
+			std::shared_lock<std::shared_mutex> lock(table->mtx);
+			for (auto& [key, row] : table->rows) {
+				if (f(row)) {
+					v.push_back(row);
+				}
+			}
+			return v;
+		}
+
+		//列式查询，结果和mysql::query_columns相同，出错时返回空
+		template<typename T>
+		column_set<T> query_columns(const std::string& condition = "") {
+			return select_into<T, column_set<T>>(condition, {});
+		}
+
+		template<typename T, typename... Args>
+		column_set<T> query_columns(const where_condition& condition, const Args&... args) {
+			return select_into<T, column_set<T>>(condition.sql, { detail::to_literal(args)... });
+		}
+
+		//结果和mysql::query_result相同，视图指向结果集自己的arena，出错时返回空
+		template<typename T>
+		result_set<T> query_result(const std::string& condition = "") {
+			return select_into<T, result_set<T>>(condition, {});
+		}
+
+		template<typename T, typename... Args>
+		result_set<T> query_result(const where_condition& condition, const Args&... args) {
+			return select_into<T, result_set<T>>(condition.sql, { detail::to_literal(args)... });
+		}
+
+		/*
+		* 接口和mysql::row_cursor相同，T为反射对象时condition是where等条件，为tuple时condition是完整的sql
+		* 创建时先复制出全部结果，遍历期间可以修改数据，cursor_options没有作用
+		*/
+		template<typename T>
+		class row_cursor {
+		public:
+			struct iterator {
+				using iterator_category = std::input_iterator_tag;
+				using value_type = T;
+				using difference_type = std::ptrdiff_t;
+				using pointer = T*;
+				using reference = T&;
+
+				T& operator*() const { return cursor_->row(); }
+				T* operator->() const { return &cursor_->row(); }
+				iterator& operator++() {
+					cursor_->next();
+					return *this;
+				}
+				void operator++(int) { ++*this; }
+				bool operator==(std::default_sentinel_t) const { return cursor_->at_end_; }
+
+				row_cursor* cursor_;
+			};
+
+			row_cursor(std::vector<T> rows, bool ok)
+				:buffered_(std::move(rows)), has_error_(!ok), at_end_(!ok) {}
+
+			row_cursor(const row_cursor&) = delete;
+			row_cursor& operator=(const row_cursor&) = delete;
+
+			//读取下一行，读完或出错时返回false
+			bool next() {
+				if (at_end_ || rows_ == buffered_.size()) {
+					at_end_ = true;
+					return false;
+				}
+
+				row_ = std::move(buffered_[rows_++]);
+				return true;
+			}
+
+			//当前行，下一次next()时会被覆盖
+			T& row() { return row_; }
+
+			iterator begin() {
+				next();
+				return iterator{ this };
+			}
+
+			std::default_sentinel_t end() { return {}; }
+
+			bool has_error() const { return has_error_; }
+			size_t rows() const { return rows_; }
+
+		private:
+			std::vector<T> buffered_;
+			T row_{};
+			size_t rows_{ 0 };
+			bool has_error_;
+			bool at_end_;
+		};
+
+		template<typename T>
+		row_cursor<T> query_cursor(const std::string& condition, const cursor_options& opt = {}) {
+			std::vector<T> v;
+			bool ok = true;
+			if constexpr (is_reflection_v<T>) {
+				v = select<T>(condition, {}, &ok);
+			}
+			else {
+				ok = select_tuples<T>(condition, {}, v);
+			}
+			return row_cursor<T>(std::move(v), ok);
+		}
+
+		//对每一行调用f，f返回false时提前结束；先复制出结果再调用，f中可以修改数据
+		template<typename T, typename F>
+		bool for_each_row(const std::string& condition, F&& f, const cursor_options& opt = {}) {
+			row_cursor<T> cursor = query_cursor<T>(condition, opt);
+			while (cursor.next()) {
+				if constexpr (std::is_same_v<bool, std::invoke_result_t<F, T&>>) {
+					if (!f(cursor.row())) {
+						break;
+					}
+				}
+				else {
+					f(cursor.row());
+				}
+			}
+			return !cursor.has_error();
+		}
+
+		template<typename T, typename... Args>
+		std::enable_if_t<!is_where_first_v<Args...>, bool> delete_records(Args &&... args) {
+			std::string condition = "";
+			append(condition, std::forward<Args>(args)...);
+			return remove<T>(condition, {});
+		}
+
+		//delete_records<Person>(manjusaka::where("id = ?"), 1)
+		template<typename T, typename... Args>
+		bool delete_records(const where_condition& condition, const Args&... args) {
+			return remove<T>(condition.sql, { detail::to_literal(args)... });
+		}
+
+		//删除谓词为true的行，返回删除的行数
+		template<typename T, typename F>
+		int delete_if(F&& f) {
+			auto table = begin_write<T>();
+			if (!table) {
+				return -1;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			return (int)std::erase_if(table->rows, [&](auto& item) {
+				if (!f(item.second)) {
+					return false;
+				}
+				save_undo(*table, item.first, std::move(item.second));
+				return true;
+			});
+		}
+
+		//不知道表的类型，只支持少数几种语句，见类的说明
+		bool execute(const std::string& sql) {
+			if (!ensure_connected()) {
+				return false;
+			}
+
+			std::vector<detail::memory_token> tokens;
+			if (!detail::tokenize(sql, tokens, error_) || tokens.empty()) {
+				error_ = error_.empty() ? "empty statement" : error_;
+				return false;
+			}
+
+			auto word = [&](size_t i, std::string_view w) {
+				return i < tokens.size() && detail::iequals(tokens[i].value, w);
+			};
+
+			if (word(0, "begin") || (word(0, "start") && word(1, "transaction"))) {
+				return begin();
+			}
+			if (word(0, "commit")) {
+				return commit();
+			}
+			if (word(0, "rollback")) {
+				return rollback();
+			}
+			if (word(0, "create")) { //表在第一次访问时创建，和其他DDL一样隐式提交
+				return commit();
+			}
+
+			//truncate [table] t、drop table [if exists] t、delete from t
+			size_t name = tokens.size();
+			if (word(0, "truncate")) {
+				name = word(1, "table") ? 2 : 1;
+			}
+			else if (word(0, "drop") && word(1, "table")) {
+				name = word(2, "if") && word(3, "exists") ? 4 : 2;
+			}
+			else if (word(0, "delete") && word(1, "from")) {
+				name = 2;
+			}
+
+			if (name + 1 != tokens.size()) {
+				error_ = "statement is not supported by memory_db";
+				return false;
+			}
+
+			//truncate和drop是DDL，先提交事务，清空的行不进undo日志；delete from可以回滚
+			bool ddl = !word(0, "delete");
+			if (ddl) {
+				commit();
+			}
+
+			if (auto table = store_->find(tokens[name].value)) {
+				std::unique_lock<std::shared_mutex> lock(table->mtx);
+				table->clear_locked(ddl ? nullptr : undo_log(*table));
+			}
+			return true;
+		}
+
+		// transaction
+		bool begin() {
+			if (!ensure_connected()) {
+				return false;
+			}
+
+			//和mysql一样，begin会提交还没结束的事务
+			commit();
+			in_transaction_ = true;
+			return true;
+		}
+
+		bool commit() {
+			undo_.clear();
+			in_transaction_ = false;
+			return true;
+		}
+
+		bool rollback() {
+			for (auto it = undo_.rbegin(); it != undo_.rend(); ++it) {
+				(*it)->rollback();
+			}
+			undo_.clear();
+			in_transaction_ = false;
+			return true;
+		}
+
+		bool in_transaction() const { return in_transaction_; }
+
+		//连接归还连接池前调用，回滚没有结束的事务
+		bool reset_session() {
+			if (store_ == nullptr) {
+				return false;
+			}
+
+			if (in_transaction_) {
+				rollback();
+			}
+
+			refreshAliveTime();
+			return true;
+		}
+
+		void refreshAliveTime() {
+			aliveTime_ = std::chrono::system_clock::now();
+		}
+
+		long long getAliveTime() {
+			auto n = std::chrono::system_clock::now();
+			auto d = std::chrono::duration_cast<std::chrono::milliseconds>(n - aliveTime_);
+			return d.count();
+		}
+
+	private:
+		template<typename... Args>
+		static memory_store& select_store(Args &&...args) {
+			if constexpr (sizeof...(Args) == 1) {
+				using A = std::decay_t<std::tuple_element_t<0, std::tuple<Args...>>>;
+				if constexpr (std::is_same_v<A, memory_store>) {
+					return (args, ...);
+				}
+				else if constexpr (std::is_same_v<A, memory_store*>) {
+					return *(args, ...);
+				}
+				else {
+					return memory_store::instance();
+				}
+			}
+			else if constexpr (sizeof...(Args) >= 4) {
+				auto&& db = std::get<3>(std::forward_as_tuple(args...));
+				if constexpr (std::is_pointer_v<std::decay_t<decltype(db)>>) {
+					return memory_store::instance(db == nullptr ? "" : db);
+				}
+				else {
+					return memory_store::instance(std::string(db));
+				}
+			}
+			else {
+				return memory_store::instance();
+			}
+		}
+
+		bool ensure_connected() {
+			if (store_ == nullptr) {
+				error_ = "not connected";
+				return false;
+			}
+			return true;
+		}
+
+		template<typename T>
+		memory_table<T>* table_of() {
+			static_assert(is_reflection_v<T>);
+			if (!ensure_connected()) {
+				return nullptr;
+			}
+
+			auto table = store_->template table<T>();
+			if (table == nullptr) {
+				error_ = std::string("table ") + T::TABLE_NAME() + " is used by another type";
+			}
+			return table;
+		}
+
+		template<typename T>
+		memory_table<T>* begin_write() {
+			error_.clear();
+			return table_of<T>();
+		}
+
+		//事务中返回table的undo日志，第一次修改这张表时创建，不在事务中返回nullptr
+		memory_undo_base* undo_log(memory_table_base& table) {
+			if (!in_transaction_) {
+				return nullptr;
+			}
+
+			for (auto& undo : undo_) {
+				if (undo->table == &table) {
+					return undo.get();
+				}
+			}
+			undo_.push_back(table.make_undo());
+			return undo_.back().get();
+		}
+
+		//修改或删除一行之前调用，记录它原来的值，调用时持有表的写锁
+		template<typename T, typename U>
+		void save_undo(memory_table<T>& table, const primary_key_t<T>& key, U&& old) {
+			if (auto undo = undo_log(table)) {
+				static_cast<memory_undo<T>*>(undo)->rows.emplace_back(key, std::forward<U>(old));
+			}
+		}
+
+		//插入新行之后调用，回滚时删除这一行
+		template<typename T>
+		void save_insert(memory_table<T>& table, const primary_key_t<T>& key) {
+			if (auto undo = undo_log(table)) {
+				static_cast<memory_undo<T>*>(undo)->rows.emplace_back(key, std::nullopt);
+			}
+		}
+
+		template<typename T>
+		bool parse(std::string_view condition, const std::vector<detail::memory_literal>& params,
+			detail::memory_query& q) {
+			std::vector<detail::memory_token> tokens;
+			if (!detail::tokenize(condition, tokens, error_)) {
+				return false;
+			}
+			return detail::memory_parser<T>(std::move(tokens), params).parse(q, error_);
+		}
+
+		//条件不支持或者出错时返回空数组，ok为false
+		template<typename T>
+		std::vector<T> select(std::string_view condition, const std::vector<detail::memory_literal>& params,
+			bool* ok = nullptr) {
+			std::vector<T> v;
+			error_.clear();
+			auto table = table_of<T>();
+			detail::memory_query q;
+			if (!table || !parse<T>(condition, params, q)) {
+				if (ok) {
+					*ok = false;
+				}
+				return v;
+			}
+
+			std::shared_lock<std::shared_mutex> lock(table->mtx);
+			auto rows = detail::select_rows(*table, q);
+			v.reserve(rows.size());
+			for (auto row : rows) {
+				v.push_back(*row);
+			}
+			return v;
+		}
+
+		//和select相同，结果逐行追加到column_set或result_set
+		template<typename T, typename Sink>
+		Sink select_into(std::string_view condition, const std::vector<detail::memory_literal>& params) {
+			Sink sink;
+			error_.clear();
+			auto table = table_of<T>();
+			detail::memory_query q;
+			if (!table || !parse<T>(condition, params, q)) {
+				return sink;
+			}
+
+			std::shared_lock<std::shared_mutex> lock(table->mtx);
+			auto rows = detail::select_rows(*table, q);
+			sink.reserve(rows.size());
+			for (auto row : rows) {
+				sink.append(detail::memory_row_reader<T>{ row });
+			}
+			return sink;
+		}
+
+		//select columns from table condition，表按名字查找，没有创建过的表和mysql一样出错
+		template<typename T>
+		bool select_tuples(const std::string& sql, const std::vector<detail::memory_literal>& params,
+			std::vector<T>& v) {
+			error_.clear();
+			std::vector<detail::memory_token> tokens;
+			if (!ensure_connected() || !detail::tokenize(sql, tokens, error_)) {
+				return false;
+			}
+
+			size_t from = 1;
+			while (from < tokens.size() && !(tokens[from].kind == detail::memory_token::word &&
+				detail::iequals(tokens[from].value, "from"))) {
+				from++;
+			}
+			if (tokens.empty() || !detail::iequals(tokens[0].value, "select") || from + 1 >= tokens.size()) {
+				error_ = "statement is not supported by memory_db";
+				return false;
+			}
+
+			auto table = store_->find(tokens[from + 1].value);
+			if (table == nullptr) {
+				error_ = "table " + tokens[from + 1].value + " doesn't exist";
+				return false;
+			}
+
+			std::vector<detail::memory_text_row> rows;
+			if (!table->select_text({ tokens.begin() + 1, tokens.begin() + from },
+				{ tokens.begin() + from + 2, tokens.end() }, params, rows, error_)) {
+				return false;
+			}
+
+			v.reserve(rows.size());
+			for (auto& row : rows) {
+				if (row.size() != std::tuple_size_v<T>) {
+					error_ = "column count does not match the tuple";
+					v.clear();
+					return false;
+				}
+
+				size_t i = 0;
+				T& t = v.emplace_back();
+				for_each_value(t, [&](auto& value) {
+					const detail::memory_literal& column = row[i++];
+					set_text_value(value, column.null ? nullptr : column.text.data(), (unsigned long)column.text.size());
+				});
+			}
+			return true;
+		}
+
+		template<typename T>
+		bool remove(std::string_view condition, const std::vector<detail::memory_literal>& params) {
+			auto table = begin_write<T>();
+			detail::memory_query q;
+			if (!table || !parse<T>(condition, params, q)) {
+				return false;
+			}
+
+			std::unique_lock<std::shared_mutex> lock(table->mtx);
+			if (q.order.empty() && q.offset == 0 && q.limit == (size_t)-1) {
+				std::erase_if(table->rows, [&](auto& item) {
+					if (!detail::matches(item.second, q)) {
+						return false;
+					}
+					save_undo(*table, item.first, std::move(item.second));
+					return true;
+				});
+				return true;
+			}
+
+			//带order by或limit时先选出要删除的行
+			std::vector<primary_key_t<T>> keys;
+			for (auto row : detail::select_rows(*table, q)) {
+				keys.push_back(get_primary_key(*row));
+			}
+			for (auto& key : keys) {
+				auto it = table->rows.find(key);
+				save_undo(*table, key, std::move(it->second));
+				table->rows.erase(it);
+			}
+			return true;
+		}
+
+		memory_store* store_{ nullptr };
+		bool in_transaction_{ false };
+		std::vector<std::unique_ptr<memory_undo_base>> undo_;
+		std::string error_;
+		std::chrono::system_clock::time_point aliveTime_;
+	};
+}
+
+#endif //MEMORY_DB_H
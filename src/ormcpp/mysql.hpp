@@ -4,24 +4,65 @@
 #include<string>
 #include<functional>
 #include<tuple>
-#include<map>
 #include<array>
 #include<string.h>
 #include<chrono>
+#include<algorithm>
+#include<cstdio>
+#include<iterator>
+#include<typeinfo>
+#include<optional>
 #include<mysql/mysql.h>
 
 #include"operation.hpp"
 #include"reflection.hpp"
 #include"type_mapping.hpp"
+#include"stmt_cache.hpp"
+#include"load_data.hpp"
+#include"result_binder.hpp"
+#include"param_binder.hpp"
+#include"text_protocol.hpp"
+#include"result_cache.hpp"
+#include"identity_map.hpp"
+#include"column_set.hpp"
+#include"result_set.hpp"
+#include"statement_stats.hpp"
 
 using blob = manjusaka::blob;
 
+namespace manjusaka {
+	/*
+	* 游标的选项
+	* server_side为true时使用服务端只读游标，每次取prefetch_rows行，期间连接可以执行其他语句
+	* 否则使用不缓冲的结果集，边读边处理，读完之前连接不能执行其他语句
+	*/
+	struct cursor_options {
+		bool server_side{ false };
+		unsigned long prefetch_rows{ 1024 };
+	};
+
+	//管线中一条语句的执行结果，出错或者因为前面的语句出错没有执行时affected_rows为-1
+	struct statement_result {
+		long long affected_rows{ -1 };
+		unsigned int error_code{ 0 };
+		std::string error;
+
+		bool ok() const { return affected_rows >= 0; }
+	};
+}
+
 class mysql {
 	
 public:
+	mysql() = default;
+	~mysql() { disconnect(); }
+	mysql(const mysql&) = delete;
+	mysql& operator=(const mysql&) = delete;
+
 	template<typename... Args>
 	bool connect(Args &&...args) {
 		if (con_ != nullptr) {
+			stmt_cache_.clear();
 			mysql_close(con_);
 		}
 
@@ -43,16 +84,25 @@ public:
 		mysql_options(con_, MYSQL_OPT_RECONNECT, &value);
 		mysql_options(con_, MYSQL_SET_CHARSET_NAME, "utf8");
 
+		//只允许bulk_load发起的LOAD DATA LOCAL，服务端请求其他文件一律拒绝
+		unsigned int local_infile = 1;
+		mysql_options(con_, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+		mysql_set_local_infile_handler(con_, &infile_init, &infile_read,
+			&infile_end, &infile_error, this);
+
 		if (std::apply(&mysql_real_connect, tp) == nullptr) {
 			return false;
 		}
 
+		thread_id_ = mysql_thread_id(con_);
+		max_allowed_packet_ = 0;
 		return true;
 	}
 
 	template<typename... Args>
 	bool disconnect(Args &&...args) {
 		if (con_ != nullptr) {
+			stmt_cache_.clear();
 			mysql_close(con_);
 			con_ = nullptr;
 		}
@@ -61,216 +111,641 @@ public:
 
 	bool ping() { return mysql_ping(con_) == 0; }
 
-	//زɹݵĸ
+	//预处理语句缓存，每个连接最多保留capacity个句柄
+	void set_stmt_cache_capacity(size_t capacity) { stmt_cache_.set_capacity(capacity); }
+	size_t stmt_cache_hits() const { return stmt_cache_.hits(); }
+	size_t stmt_cache_misses() const { return stmt_cache_.misses(); }
+
+	/*
+	* 打开后query<T>(反射对象)先查进程内的结果缓存，配置和命中率见manjusaka::result_cache
+	* 不管是否打开，写操作都会使对应表的缓存失效
+	*/
+	void use_result_cache(bool enable) { use_result_cache_ = enable; }
+
+	//返回插入成功数据的个数
 	template<typename T>
     int insert(const T& t) {
-		std::string sql = manjusaka::generate_insert_sql<T>();
+		constexpr std::string_view sql = manjusaka::generate_insert_sql<T>();
 		/*manjusaka::forEach(t, [&](auto&& fieldname, auto&& value) {
 			manjusaka::get_str(sql, manjusaka::to_str(value));
 		});*/
 
-		stmt_ = mysql_stmt_init(con_);
-		if (!stmt_) {
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
 			return -1;
 		}
 
-		if (mysql_stmt_prepare(stmt_, sql.c_str(), (int)sql.size())) {
-			return -1;
-		}
+		auto guard = guard_statement(this, sql);
 
-		auto guard = guard_statement(stmt_);
-
-		if (stmt_execute(t) < 0) {
+		if (probe.active()) {
+			probe.bytes_sent(estimate_row_size(t));
+		}
+		if (!lap(probe, phase::execute, stmt_execute(t) >= 0)) {
 			return -1;
 		}
 
+		probe.rows(1);
+		invalidate_cache(T::TABLE_NAME());
 		return 1;
 	}
 
-	//
+	/*
+	* 批量插入
+	* 按块生成insert ... values(...),(...)，每块一次往返
+	* 块的行数不超过batch_rows，估算的包大小不超过max_allowed_packet
+	* 满块的sql都相同，会命中语句缓存
+	*/
 	template<typename T>
 	int insert(const std::vector<T>& t) {
-		std::string sql = manjusaka::generate_insert_sql<T>();
+		return execute_chunks(t, false);
+	}
 
-		stmt_ = mysql_stmt_init(con_);
-		if (!stmt_) {
+	/*
+	* 批量插入或更新，按块生成insert ... on duplicate key update col = values(col)
+	* 分块的方式和批量插入相同，全部在一个事务中完成
+	* 返回服务端报告的影响行数之和：新插入的行算1，更新的行算2，值没变的行算0
+	*/
+	template<typename T>
+	int upsert(const std::vector<T>& t) {
+		return execute_chunks(t, true);
+	}
+
+	//按key_field更新其他字段，返回影响的行数(值没有变化时为0)，出错返回-1
+	template<typename T>
+	int update(const T& t, std::string_view key_field) {
+		constexpr size_t size = T::field_count;
+		const size_t key = manjusaka::field_index<T>(key_field);
+		if (key == size || size < 2) {
 			return -1;
 		}
 
-		if (mysql_stmt_prepare(stmt_, sql.c_str(), (int)sql.size())) {
+		std::string sql = manjusaka::generate_update_by_key_sql<T>(key);
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
 			return -1;
 		}
 
-		auto guard = guard_statement(stmt_);
+		auto guard = guard_statement(this, sql);
 
-		//ԭӲ֤
-		bool b = begin();
-		if (!b) {
+		//按字段顺序绑定后把key移到最后，对应where中的占位符
+		std::array<MYSQL_BIND, size> param_binds;
+		manjusaka::param_layout<T>::bind(t, param_binds.data());
+		std::rotate(param_binds.begin() + key, param_binds.begin() + key + 1, param_binds.end());
+
+		if (probe.active()) {
+			probe.bytes_sent(estimate_row_size(t));
+		}
+		if (!lap(probe, phase::execute, !mysql_stmt_bind_param(stmt_, param_binds.data()) &&
+			!mysql_stmt_execute(stmt_))) {
 			return -1;
 		}
 
-		for (auto& item : t) {
-			int r = stmt_execute(item);
-			if (r == -1) {
-				rollback();
-				return -1;
+		int count = (int)mysql_stmt_affected_rows(stmt_);
+		probe.rows(count);
+		invalidate_cache(T::TABLE_NAME());
+		return count;
+	}
+
+	//按主键更新，主键用DEFINE_PRIMARY_KEY声明，没有声明时为第一个字段
+	template<typename T>
+	int update(const T& t) {
+		return update(t, manjusaka::field_names_v<T>[manjusaka::primary_key_index_v<T>]);
+	}
+
+	/*
+	* 按主键查询一个对象，没有找到或者出错时返回空
+	* identity_map打开时先查缓存，表被修改过的对象不会命中
+	* 事务中不使用identity_map，读到的可能是未提交的数据，不能让其他连接看到
+	*/
+	template<typename T>
+	std::optional<T> find_by_id(const manjusaka::primary_key_t<T>& key) {
+		auto& map = manjusaka::identity_map<T>::instance();
+		bool use_map = map.enabled() && !in_transaction();
+		if (use_map) {
+			if (auto t = map.get(key)) {
+				return t;
 			}
 		}
-		b = commit();
 
-		return b ? (int)t.size() : -1;
+		uint64_t version = map.version();
+		auto param_binds = manjusaka::make_param_binds(key);
+		std::vector<T> v;
+		if (!fetch_rows(manjusaka::fixed_sql_of<T>::select_by_key.view(), param_binds.data(),
+			param_binds.size(), v) || v.empty()) {
+			return std::nullopt;
+		}
+
+		if (use_map) {
+			map.put(v.front(), version);
+		}
+		return std::move(v.front());
 	}
 
-	//ӳ汾
-	//ض
-	template<typename T, typename... Args>
-	std::enable_if_t<manjusaka::is_reflection_v<T>, std::vector<T>> query(Args &&...args) {
-		std::string condition = "";
-		manjusaka::append(condition, std::forward<Args>(args)...);
-		std::string sql = manjusaka::generate_select_sql<T>(condition);
-		constexpr size_t size = T::field_count;
+	/*
+	* 按主键批量查询，缓存中没有的合并成where id in (...)，一次往返取回多个对象
+	* 结果的顺序和keys无关，不存在的主键没有对应的对象，出错返回空数组
+	* 和find_by_id一样，事务中不使用identity_map
+	*/
+	template<typename T>
+	std::vector<T> find_many(const std::vector<manjusaka::primary_key_t<T>>& keys) {
+		auto& map = manjusaka::identity_map<T>::instance();
+		bool use_map = map.enabled() && !in_transaction();
+		std::vector<T> v;
+		v.reserve(keys.size());
 
-		stmt_ = mysql_stmt_init(con_);
-		if (!stmt_) {
-			return {};
+		std::vector<manjusaka::primary_key_t<T>> missing;
+		if (use_map) {
+			for (auto& key : keys) {
+				if (auto t = map.get(key)) {
+					v.push_back(std::move(*t));
+				}
+				else {
+					missing.push_back(key);
+				}
+			}
+		}
+		else {
+			missing = keys;
 		}
 
-		auto guard = guard_statement(stmt_);
-		/*test
-		std::cout << sql << std::endl;*/
+		if (missing.empty()) {
+			return v;
+		}
+
+		//重复的主键只查一次，补位时也不会多出结果
+		std::sort(missing.begin(), missing.end());
+		missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
 
-		if (mysql_stmt_prepare(stmt_, sql.c_str(), (unsigned long)sql.size())) {
+		uint64_t version = map.version();
+		size_t hit_count = v.size();
+		if (!fetch_by_keys(missing, v)) {
 			return {};
 		}
 
-		std::array<MYSQL_BIND, size> param_binds = {};
-		std::map<size_t, std::vector<char>> mp;
+		if (use_map) {
+			for (size_t i = hit_count; i < v.size(); i++) {
+				map.put(v[i], version);
+			}
+		}
+		return v;
+	}
 
-		std::vector<T>v; //ض
-		T t{};
-		int index = 0;
-		manjusaka::forEach(t, [&](auto&& fieldName, auto&& value) {
-			set_param_bind(param_binds[index], value, index, mp);
-			index++;
-		});
+	//批量插入时每条语句的最大行数
+	void set_batch_rows(size_t rows) { batch_rows_ = rows == 0 ? 1 : rows; }
 
-		if (index == 0) {
-			return {};
+	/*
+	* 用LOAD DATA LOCAL INFILE导入大量数据，比多行insert快得多
+	* range中的对象边读边序列化，不生成临时文件，内存占用和行数无关
+	* 需要服务端打开local_infile
+	* 返回导入的行数，失败返回-1
+	*/
+	template<typename T, typename Range>
+	long long bulk_load(const Range& range) {
+		static_assert(manjusaka::is_reflection_v<T>);
+		using Iter = decltype(std::begin(range));
+		static_assert(std::is_same_v<T, std::decay_t<decltype(*std::declval<Iter>())>>);
+
+		constexpr std::string_view sql = manjusaka::generate_load_data_sql<T>();
+		manjusaka::tsv_reader<Iter> reader(std::begin(range), std::end(range));
+
+		infile_reader_ = &reader;
+		bool ok = text_query(sql);
+		infile_reader_ = nullptr;
+		if (!ok) {
+			return -1;
 		}
 
-		if (mysql_stmt_bind_result(stmt_, &param_binds[0])) {
-			return {};
+		invalidate_cache(T::TABLE_NAME());
+		return (long long)mysql_affected_rows(con_);
+	}
+
+	//映射对象版本
+	//返回对象的数组
+	template<typename T, typename... Args>
+	std::enable_if_t<manjusaka::is_reflection_v<T> && !manjusaka::is_where_first_v<Args...>,
+		std::vector<T>> query(Args &&...args) {
+		std::string condition = "";
+		manjusaka::append(condition, std::forward<Args>(args)...);
+		std::string sql = manjusaka::generate_select_sql<T>(condition);
+		/*test
+		std::cout << sql << std::endl;*/
+
+		return query_impl<T>(sql);
+	}
+
+	/*
+	* 参数绑定版本，?按顺序绑定args，所有取值共用一个预处理语句
+	* query<Person>(manjusaka::where("age > ? and name = ?"), 18, "JOJO")
+	*/
+	template<typename T, typename... Args>
+	std::enable_if_t<manjusaka::is_reflection_v<T>, std::vector<T>> query(
+		const manjusaka::where_condition& condition, const Args&... args) {
+		std::string sql = manjusaka::generate_select_sql<T>(condition.sql);
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return query_impl<T>(sql, param_binds.data(), param_binds.size());
+	}
+
+	//指定字段版本
+	//返回tuple，sql中的?按顺序绑定args
+	template<typename T, typename... Args>
+	std::enable_if_t<!manjusaka::is_reflection_v<T>, std::vector<T>> query(const std::string& sql,
+		const Args&... args) {
+		static_assert(manjusaka::is_tuple_v<T>);
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return query_impl<T>(sql, param_binds.data(), param_binds.size());
+	}
+
+	/*
+	* 投影查询，只取出指定的字段，结果的列按名字对应到字段，其他字段保持默认值
+	* select<&Person::id, &Person::name>("where age > 18")
+	* select<&Person::id, &Person::name>(manjusaka::where("age > ?"), 18)
+	* 成员不是DEFINE_TABLE中的字段时返回空数组
+	*/
+	template<auto... Members, typename... Args>
+	std::enable_if_t<!manjusaka::is_where_first_v<Args...>,
+		std::vector<manjusaka::member_class_t<Members...>>> select(Args &&...args) {
+		std::string condition = "";
+		manjusaka::append(condition, std::forward<Args>(args)...);
+		return query_impl<manjusaka::member_class_t<Members...>>(make_projection_sql<Members...>(condition));
+	}
+
+	template<auto... Members, typename... Args>
+	std::vector<manjusaka::member_class_t<Members...>> select(
+		const manjusaka::where_condition& condition, const Args&... args) {
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return query_impl<manjusaka::member_class_t<Members...>>(make_projection_sql<Members...>(condition.sql),
+			param_binds.data(), param_binds.size());
+	}
+
+	//和select相同，结果是按成员顺序排列的tuple
+	template<auto... Members, typename... Args>
+	std::enable_if_t<!manjusaka::is_where_first_v<Args...>,
+		std::vector<std::tuple<typename manjusaka::member_traits<Members>::value_type...>>> select_tuple(Args &&...args) {
+		std::string condition = "";
+		manjusaka::append(condition, std::forward<Args>(args)...);
+		return query_impl<std::tuple<typename manjusaka::member_traits<Members>::value_type...>>(
+			make_projection_sql<Members...>(condition));
+	}
+
+	template<auto... Members, typename... Args>
+	std::vector<std::tuple<typename manjusaka::member_traits<Members>::value_type...>> select_tuple(
+		const manjusaka::where_condition& condition, const Args&... args) {
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return query_impl<std::tuple<typename manjusaka::member_traits<Members>::value_type...>>(
+			make_projection_sql<Members...>(condition.sql), param_binds.data(), param_binds.size());
+	}
+
+	/*
+	* 逐行读取查询结果，内存占用和结果集大小无关
+	* T为反射对象时condition是where等条件，为tuple时condition是完整的sql
+	* 游标存活期间不能销毁连接
+	*/
+	template<typename T>
+	class row_cursor {
+	public:
+		struct iterator {
+			using iterator_category = std::input_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = T*;
+			using reference = T&;
+
+			T& operator*() const { return cursor_->row(); }
+			T* operator->() const { return &cursor_->row(); }
+			iterator& operator++() {
+				cursor_->next();
+				return *this;
+			}
+			void operator++(int) { ++*this; }
+			bool operator==(std::default_sentinel_t) const { return cursor_->at_end_; }
+
+			row_cursor* cursor_;
+		};
+
+		row_cursor(mysql* db, std::string sql, const manjusaka::cursor_options& opt)
+			:db_(db), sql_(std::move(sql)) {
+			stmt_ = db_->checkout_statement(sql_);
+			if (stmt_ == nullptr) {
+				return;
+			}
+
+			if (opt.server_side) {
+				unsigned long type = CURSOR_TYPE_READ_ONLY;
+				unsigned long prefetch = opt.prefetch_rows == 0 ? 1 : opt.prefetch_rows;
+				mysql_stmt_attr_set(stmt_, STMT_ATTR_CURSOR_TYPE, &type);
+				mysql_stmt_attr_set(stmt_, STMT_ATTR_PREFETCH_ROWS, &prefetch);
+			}
+
+			if (mysql_stmt_execute(stmt_)) {
+				return;
+			}
+
+			if (!binder_.bind(stmt_, false)) {
+				return;
+			}
+
+			has_error_ = false;
+			at_end_ = false;
 		}
 
-		if (mysql_stmt_execute(stmt_)) {
-			return {};
+		~row_cursor() {
+			if (stmt_ != nullptr) {
+				db_->checkin_statement(sql_, stmt_);
+			}
 		}
 
-		//ƥ
-		while (mysql_stmt_fetch(stmt_) == 0) {
-			index = 0;
-			manjusaka::forEach(t, [&](auto&& fieldName, auto&& value) {
-				set_value(param_binds[index], value, index, mp);
-				index++;
-				
-			});
+		row_cursor(const row_cursor&) = delete;
+		row_cursor& operator=(const row_cursor&) = delete;
 
-			for (auto& p : mp) {
-				p.second.assign(p.second.size(), 0);
+		//读取下一行，读完或出错时返回false
+		bool next() {
+			if (at_end_) {
+				return false;
 			}
 
-			v.push_back(std::move(t));
-			manjusaka::forEach(t, [&](auto&& fieldName, auto&& value) {
-				using U = std::remove_reference_t<decltype(value)>;
-				if constexpr (std::is_arithmetic_v<U>) {
-					memset(&value, 0, sizeof(U));
+			int r = binder_.fetch(row_);
+			if (r != 0) {
+				has_error_ = r != MYSQL_NO_DATA;
+				at_end_ = true;
+				return false;
+			}
+
+			rows_++;
+			return true;
+		}
+
+		//当前行，下一次next()时会被覆盖
+		T& row() { return row_; }
+
+		iterator begin() {
+			next();
+			return iterator{ this };
+		}
+
+		std::default_sentinel_t end() { return {}; }
+
+		bool has_error() const { return has_error_; }
+		size_t rows() const { return rows_; }
+
+	private:
+		mysql* db_;
+		std::string sql_;
+		MYSQL_STMT* stmt_{ nullptr };
+		std::vector<char> buffer_;
+		manjusaka::result_binder<T> binder_{ buffer_ }; //绑定的是binder_内部的地址，所以游标不能移动
+		T row_{};
+		size_t rows_{ 0 };
+		bool has_error_{ true };
+		bool at_end_{ true };
+	};
+
+	template<typename T>
+	row_cursor<T> query_cursor(const std::string& condition,
+		const manjusaka::cursor_options& opt = {}) {
+		return row_cursor<T>(this, make_select_sql<T>(condition), opt);
+	}
+
+	//对每一行调用f，f返回false时提前结束
+	template<typename T, typename F>
+	bool for_each_row(const std::string& condition, F&& f,
+		const manjusaka::cursor_options& opt = {}) {
+		row_cursor<T> cursor(this, make_select_sql<T>(condition), opt);
+		while (cursor.next()) {
+			if constexpr (std::is_same_v<bool, std::invoke_result_t<F, T&>>) {
+				if (!f(cursor.row())) {
+					break;
 				}
-			});
+			}
+			else {
+				f(cursor.row());
+			}
 		}
-		return v;
+		return !cursor.has_error();
 	}
 
-	//ֶָΰ汾
-	//tuple
+	/*
+	* 列式查询，每个字段一列，用于只汇总少数几列的大查询
+	* 结果不在客户端缓冲，边读边追加到各列，出错时返回空
+	*/
 	template<typename T>
-	std::enable_if_t<!manjusaka::is_reflection_v<T>, std::vector<T>> query(const std::string& sql) {
-		static_assert(manjusaka::is_tuple_v<T>);
-		const auto size = std::tuple_size_v<T>;
-		
-		stmt_ = mysql_stmt_init(con_);
-		if (!stmt_) {
-			return {};
-		}
+	manjusaka::column_set<T> query_columns(const std::string& condition = "") {
+		return fetch_into<T, manjusaka::column_set<T>>(manjusaka::generate_select_sql<T>(condition), nullptr, 0);
+	}
 
-		auto guard = guard_statement(stmt_);
+	template<typename T, typename... Args>
+	manjusaka::column_set<T> query_columns(const manjusaka::where_condition& condition, const Args&... args) {
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return fetch_into<T, manjusaka::column_set<T>>(manjusaka::generate_select_sql<T>(condition.sql),
+			param_binds.data(), param_binds.size());
+	}
 
-		if (mysql_stmt_prepare(stmt_, sql.c_str(), (unsigned long)sql.size())) {
-			return {};
+	/*
+	* 零拷贝查询，行的字符串和blob字段是指向结果集arena的视图，不为每个字段分配内存
+	* 结果集存活期间视图有效，需要对象时调用materialize()，出错时返回空
+	*/
+	template<typename T>
+	manjusaka::result_set<T> query_result(const std::string& condition = "") {
+		return fetch_into<T, manjusaka::result_set<T>>(manjusaka::generate_select_sql<T>(condition), nullptr, 0);
+	}
+
+	template<typename T, typename... Args>
+	manjusaka::result_set<T> query_result(const manjusaka::where_condition& condition, const Args&... args) {
+		auto param_binds = manjusaka::make_param_binds(args...);
+		return fetch_into<T, manjusaka::result_set<T>>(manjusaka::generate_select_sql<T>(condition.sql),
+			param_binds.data(), param_binds.size());
+	}
+
+	/*
+	* 多语句管线，语句先在本地排队，run时用一个包发出去，再用mysql_next_result逐条读取结果
+	* 连接平时不允许多语句，只在run期间用mysql_set_server_option打开，
+	* 这样execute和拼接条件的delete_records不会执行注入的第二条语句
+	* "BEGIN; delete; insert; update; COMMIT"只需要一次往返
+	* 服务端遇到出错的语句就不再执行后面的语句，如果管线开启的事务还没结束则回滚
+	* 所有语句加起来不能超过max_allowed_packet
+	*/
+	class pipeline {
+	public:
+		explicit pipeline(mysql* db) : db_(db) {}
+
+		pipeline& execute(std::string_view sql) {
+			//去掉结尾的分号，统一在语句之间加
+			while (!sql.empty() && (sql.back() == ';' || sql.back() == ' ' || sql.back() == '\n')) {
+				sql.remove_suffix(1);
+			}
+
+			if (!sql.empty()) {
+				if (count_ > 0) {
+					sql_ += ';';
+				}
+				sql_ += sql;
+				count_++;
+			}
+			return *this;
 		}
-		
-		std::array<MYSQL_BIND, size> param_binds = {};
-		std::map<size_t, std::vector<char>> mp;
 
-		std::vector<T> v;
-		T tp{};
-		int index = 0;
-		manjusaka::forEach(tp, [&](auto&& value) {
-			set_param_bind(param_binds[index], value, index, mp);
-			index++;
-		});
-		
+		template<typename T, typename... Args>
+		pipeline& delete_records(Args &&... args) {
+			std::string condition = "";
+			manjusaka::append(condition, std::forward<Args>(args)...);
+			return execute(manjusaka::generate_delete_sql<T>(condition));
+		}
 
-		if (index == 0) {
-			return {};
+		//参数在客户端转义后写进sql
+		template<typename T>
+		pipeline& insert(const T& t) {
+			const T* first = &t;
+			return execute(manjusaka::generate_insert_values_sql(db_->con_, first, first + 1));
 		}
 
-		if (mysql_stmt_bind_result(stmt_, &param_binds[0])) {
-			return {};
+		//每batch_rows行生成一条语句
+		template<typename T>
+		pipeline& insert(const std::vector<T>& t) {
+			const T* first = t.data();
+			const T* last = t.data() + t.size();
+			while (first != last) {
+				execute(manjusaka::generate_insert_values_sql(db_->con_, first, last, db_->batch_rows_));
+			}
+			return *this;
 		}
 
-		if (mysql_stmt_execute(stmt_)) {
-			return {};
+		// transaction
+		pipeline& begin() {
+			began_ = true;
+			return execute("BEGIN");
 		}
 
-		while (mysql_stmt_fetch(stmt_) == 0) {
-			index = 0;
-			manjusaka::forEach(tp, [&](auto&& value) {
-				set_value(param_binds[index], value, index, mp);
-				index++;
-			});
+		pipeline& commit() { return execute("COMMIT"); }
+		pipeline& rollback() { return execute("ROLLBACK"); }
+
+		size_t size() const { return count_; }
+
+		void clear() {
+			sql_.clear();
+			count_ = 0;
+			began_ = false;
+		}
+
+		//按排队的顺序返回每条语句的结果，执行后管线清空，可以继续使用
+		std::vector<manjusaka::statement_result> run() {
+			std::vector<manjusaka::statement_result> results(count_);
+			if (count_ == 0) {
+				return results;
+			}
+
+			MYSQL* con = db_->con_;
+			if (mysql_set_server_option(con, MYSQL_OPTION_MULTI_STATEMENTS_ON) != 0) {
+				results[0].error_code = mysql_errno(con);
+				results[0].error = mysql_error(con);
+				clear();
+				return results;
+			}
+
+			size_t i = 0;
+			//0表示还有结果，-1表示全部读完，大于0表示第i条语句出错
+			int status = mysql_real_query(con, sql_.data(), (unsigned long)sql_.size());
+			while (status == 0) {
+				if (i == results.size()) { //execute传入的sql本身包含多条语句
+					results.emplace_back();
+				}
+
+				//结果集直接丢弃，select的affected_rows是返回的行数
+				MYSQL_RES* res = mysql_store_result(con);
+				if (res != nullptr) {
+					mysql_free_result(res);
+				}
+
+				if (mysql_errno(con) != 0) {
+					status = 1;
+					break;
+				}
+
+				results[i].affected_rows = (long long)mysql_affected_rows(con);
+				i++;
+				status = mysql_next_result(con);
+			}
+
+			if (status > 0) {
+				if (i == results.size()) {
+					results.emplace_back();
+				}
+				results[i].error_code = mysql_errno(con);
+				results[i].error = mysql_error(con);
+			}
+
+			//关不掉时断开连接，连接池归还时reset_session失败会丢弃它，不能带着多语句继续使用
+			if (mysql_set_server_option(con, MYSQL_OPTION_MULTI_STATEMENTS_OFF) != 0) {
+				db_->disconnect();
+			}
 
-			for (auto& p : mp) {
-				p.second.assign(p.second.size(), 0);
+			if (status > 0 && began_ && db_->in_transaction()) {
+				db_->rollback();
 			}
 
-			v.push_back(std::move(tp));
+			db_->invalidate_cache();
+			clear();
+			return results;
 		}
-		return v;
-	}
+
+	private:
+		mysql* db_;
+		std::string sql_;
+		size_t count_{ 0 };
+		bool began_{ false };
+	};
+
+	pipeline create_pipeline() { return pipeline(this); }
 
 	template<typename T, typename... Args>
-	bool delete_records(Args &&... args) {
+	std::enable_if_t<!manjusaka::is_where_first_v<Args...>, bool> delete_records(Args &&... args) {
 		std::string condition = "";
 		manjusaka::append(condition, std::forward<Args>(args)...);
 		std::string sql = manjusaka::generate_delete_sql<T>(condition);
 
-		if (mysql_query(con_, sql.data())) {
-			//record
+		if (!text_query(sql)) {
 			return false;
 		}
+
+		invalidate_cache(T::TABLE_NAME());
 		return true;
 	}
 
+	//参数绑定版本，delete_records<Person>(manjusaka::where("id = ?"), 1)
+	template<typename T, typename... Args>
+	bool delete_records(const manjusaka::where_condition& condition, const Args&... args) {
+		std::string sql = manjusaka::generate_delete_sql<T>("");
+		sql += ' ';
+		sql += condition.sql;
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
+			return false;
+		}
+
+		auto guard = guard_statement(this, sql);
+
+		auto param_binds = manjusaka::make_param_binds(args...);
+		if (!lap(probe, phase::execute, bind_params(param_binds.data(), param_binds.size()) &&
+			!mysql_stmt_execute(stmt_))) {
+			return false;
+		}
+
+		probe.rows(mysql_stmt_affected_rows(stmt_));
+		invalidate_cache(T::TABLE_NAME());
+		return true;
+	}
+
+	//不知道sql修改了哪些表，使整个结果缓存失效
 	bool execute(const std::string& sql) {
-		if (mysql_query(con_, sql.data()) != 0) {
+		if (!text_query(sql)) {
 			return false;
 		}
+
+		invalidate_cache();
 		return true;
 	}
 
 	// transaction
 	bool begin() {
-		if (mysql_query(con_, "BEGIN")) {
+		if (!text_query("BEGIN")) {
 			return false;
 		}
 
@@ -278,18 +753,43 @@ public:
 	}
 
 	bool commit() {
-		if (mysql_query(con_, "COMMIT")) {
+		if (!text_query("COMMIT")) {
 			return false;
 		}
 
+		flush_dirty_tables();
 		return true;
 	}
 
 	bool rollback() {
-		if (mysql_query(con_, "ROLLBACK")) {
+		if (!text_query("ROLLBACK")) {
 			return false;
 		}
 
+		flush_dirty_tables();
+		return true;
+	}
+
+	//服务端在OK包里带回事务状态，不需要额外查询
+	bool in_transaction() const {
+		return con_ != nullptr && (con_->server_status & SERVER_STATUS_IN_TRANS) != 0;
+	}
+
+	/*
+	* 连接归还连接池前调用，恢复到可以交给下一个使用者的状态
+	* 回滚没有结束的事务，缓存的预处理语句保留
+	* 返回false表示连接已经不可用
+	*/
+	bool reset_session() {
+		if (con_ == nullptr) {
+			return false;
+		}
+
+		if (in_transaction() && !rollback()) {
+			return false;
+		}
+
+		refreshAliveTime();
 		return true;
 	}
 
@@ -304,137 +804,260 @@ public:
 	}
 
 private:
+	template<typename T>
+	std::vector<T> query_impl(std::string_view sql, MYSQL_BIND* param_binds = nullptr, size_t param_count = 0) {
+		bool ok = false;
+		if constexpr (manjusaka::is_reflection_v<T>) {
+			if (use_result_cache_) {
+				return query_cached<T>(sql, param_binds, param_count);
+			}
+		}
+		return fetch_all<T>(sql, param_binds, param_count, ok);
+	}
+
 	/*
-	* ڲѯʱ󶨲
-	* param_binds  
-	* value : ֶεֵ
-	* i : 󶨲param_bindsе
-	* mp : ڽiparam_bindsеĻ,ͬʱҲǴڰ󶨽
+	* 键是结果类型、sql和参数，值是整个结果数组
+	* 版本号在查询前读取，查询期间有写操作时这次的结果放进缓存也不会命中
+	* tuple查询不知道涉及哪些表，不走缓存
 	*/
 	template<typename T>
-	void set_param_bind(MYSQL_BIND& param_bind, T&& value, int i,
-		std::map<size_t, std::vector<char>>& mp) {
-		using U = std::remove_const_t<std::remove_reference_t<T>>;
-		if constexpr (manjusaka::is_optional_v<U>) {
-			return set_bind_bind(param_bind, *value, i, mp);
+	std::vector<T> query_cached(std::string_view sql, MYSQL_BIND* param_binds, size_t param_count) {
+		/*
+		* 事务中既不读也不写缓存：读到的结果可能包含本连接还没提交的修改，
+		* 放进进程内共享的缓存后其他连接会读到，回滚后就是不存在的数据；
+		* 反过来缓存中的结果也看不到本事务自己的修改
+		*/
+		if (in_transaction()) {
+			bool ok = false;
+			return fetch_all<T>(sql, param_binds, param_count, ok);
 		}
-		else if constexpr (std::is_arithmetic_v<U>) {
-			param_bind.buffer_type = (enum_field_types)manjusaka::type_to_id(manjusaka::identity<U>{});
-			param_bind.buffer = const_cast<void*>(static_cast<const void*>(&value));
-		}
-		else if constexpr (std::is_same_v<std::string, U>) {
-			param_bind.buffer_type = MYSQL_TYPE_STRING;
-			std::vector<char> tmp(65536, 0);
-			mp.emplace(i, std::move(tmp));
-			param_bind.buffer = &(mp.rbegin()->second[0]);
-			param_bind.buffer_length = 65536;
-		}
-		else if constexpr (manjusaka::is_char_array_v<U>) {
-			param_bind.buffer_type = MYSQL_TYPE_VAR_STRING;
-			std::vector<char> tmp(sizeof(U), 0);
-			mp.emplace(i, std::move(tmp));
-			param_bind.buffer = &(mp.rbegin()->second[0]);
-			param_bind.buffer_length = (unsigned long)sizeof(U);
+
+		auto& cache = manjusaka::result_cache::instance();
+		constexpr std::string_view table = T::TABLE_NAME();
+
+		std::string key = typeid(T).name();
+		key += '\0';
+		key += sql;
+		manjusaka::append_param_key(key, param_binds, param_count);
+		if (auto rows = cache.get<T>(key, table)) {
+			return *rows;
 		}
-		else if constexpr (std::is_same_v<manjusaka::blob, U>) {
-			param_bind.buffer_type = MYSQL_TYPE_BLOB;
-			std::vector<char> tmp(65536, 0);
-			mp.emplace(i, std::move(tmp));
-			param_bind.buffer = &(mp.rbegin()->second[0]);
-			param_bind.buffer_length = 65536;
+
+		uint64_t version = cache.version(table);
+		bool ok = false;
+		std::vector<T> v = fetch_all<T>(sql, param_binds, param_count, ok);
+		if (ok) {
+			cache.put(key, version, v);
 		}
+		return v;
 	}
 
-	
+	template<typename T>
+	std::vector<T> fetch_all(std::string_view sql, MYSQL_BIND* param_binds, size_t param_count, bool& ok) {
+		std::vector<T> v; //返回对象
+		ok = fetch_rows(sql, param_binds, param_count, v);
+		return v;
+	}
 
 	/*
-	* òѯĲ
-	* һ
+	* 查询的结果先全部缓存到客户端，再按每列实际的最大长度分配缓冲区
+	* 缓冲区在多次查询之间复用
+	* 结果追加到v的末尾，返回结果是否完整
 	*/
-	
 	template<typename T>
-	void set_value(MYSQL_BIND& param_bind, T&& value, int i,
-		std::map<size_t, std::vector<char>>& mp) {
-		using U = std::remove_const_t<std::remove_reference_t<T>>;
-		if constexpr (manjusaka::is_optional_v<U>) {
-			using value_type = typename U::value_type;
-			if constexpr (std::is_arithmetic_v<value_type>) {
-				value_type item;
-				memcpy(&item, param_bind.buffer, sizeof(value_type));
-				value = std::move(item);
-			}
-			else {
-				value_type item;
-				value = std::move(item);
-				return set_value(param_bind, *value, i, mp);
-			}
+	bool fetch_rows(std::string_view sql, MYSQL_BIND* param_binds, size_t param_count, std::vector<T>& v) {
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
+			return false;
 		}
-		else if constexpr (std::is_same_v<std::string, U>) {
-			auto& vec = mp[i]; //
-			value = std::string(&vec[0], strlen(vec.data()));
+
+		auto guard = guard_statement(this, sql);
+
+		bool update_max_length = true;
+		mysql_stmt_attr_set(stmt_, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+
+		if (!lap(probe, phase::execute, bind_params(param_binds, param_count) && !mysql_stmt_execute(stmt_))) {
+			return false;
+		}
+
+		if (!lap(probe, phase::fetch, !mysql_stmt_store_result(stmt_))) {
+			return false;
 		}
-		else if constexpr (manjusaka::is_char_array_v<U>) {
-			auto& vec = mp[i];
-			memcpy(value, vec.data(), vec.size());
+
+		manjusaka::result_binder<T> binder(result_buffer_);
+		if (!lap(probe, phase::materialize, binder.bind(stmt_, true))) {
+			return false;
 		}
-		else if constexpr (std::is_same_v<manjusaka::blob, U>) {
-			auto& vec = mp[i];
-			value = blob(vec.data(), vec.data() + get_blob_len(i));
+
+		size_t first = v.size();
+		v.reserve(v.size() + (size_t)mysql_stmt_num_rows(stmt_));
+
+		//匹配结果
+		T t{};
+		int r;
+		while ((r = binder.fetch(t)) == 0) {
+			if (probe.active()) {
+				probe.bytes_received(binder.row_bytes());
+			}
+			v.push_back(std::move(t));
 		}
+
+		probe.rows(v.size() - first);
+		return lap(probe, phase::materialize, r == MYSQL_NO_DATA);
 	}
 
 	/*
-	* ڲʱ󶨲
-	* param_binds : 
-	* value ֶεֵ
+	* 不缓冲结果集，每读一行调用一次sink.append(binder)，不构造T
+	* 出错时清空sink，sink是column_set或result_set
 	*/
+	template<typename T, typename Sink>
+	Sink fetch_into(std::string_view sql, MYSQL_BIND* param_binds, size_t param_count) {
+		static_assert(manjusaka::is_reflection_v<T>);
+		Sink sink;
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
+			return sink;
+		}
+
+		auto guard = guard_statement(this, sql);
+
+		if (!lap(probe, phase::execute, bind_params(param_binds, param_count) && !mysql_stmt_execute(stmt_))) {
+			return sink;
+		}
+
+		//不缓冲，读取和转换交替进行，都记在fetch
+		manjusaka::result_binder<T> binder(result_buffer_);
+		if (!lap(probe, phase::fetch, binder.bind(stmt_, false))) {
+			return sink;
+		}
+
+		int r;
+		while ((r = binder.fetch_row()) == 0) {
+			if (probe.active()) {
+				probe.bytes_received(binder.row_bytes());
+			}
+			sink.append(binder);
+		}
+
+		probe.rows(sink.size());
+		if (!lap(probe, phase::fetch, r == MYSQL_NO_DATA)) {
+			sink.clear();
+		}
+		return sink;
+	}
+
+	//按主键查询未命中的部分，每条语句的主键个数取不小于剩余个数的2的幂，不够的重复最后一个
+	//这样只会生成少数几种sql，都能留在语句缓存中
 	template<typename T>
-	constexpr void set_param_bind(std::vector<MYSQL_BIND>& param_binds, T&& value) {
-		MYSQL_BIND param = {};
-		using U = std::remove_const_t<std::remove_reference_t<T>>;
+	bool fetch_by_keys(const std::vector<manjusaka::primary_key_t<T>>& keys, std::vector<T>& v) {
+		using key_type = manjusaka::primary_key_t<T>;
+		constexpr size_t max_keys = 128;
+
+		size_t first = 0;
+		while (first < keys.size()) {
+			size_t rest = keys.size() - first;
+			size_t count = 1;
+			while (count < rest && count < max_keys) {
+				count *= 2;
+			}
 
-		if constexpr (manjusaka::is_optional_v<U>) { //жǷoptional
-			if (value.has_value()) {
-				return set_param_bind(param_binds, std::move(value.value()));
+			std::vector<MYSQL_BIND> param_binds(count, manjusaka::make_param_bind<key_type>());
+			for (size_t i = 0; i < count; i++) {
+				manjusaka::set_param_buffer(param_binds[i], keys[first + (std::min)(i, rest - 1)]);
 			}
-			else {
-				param.buffer_type = MYSQL_TYPE_NULL;
+
+			if (!fetch_rows(manjusaka::generate_select_in_sql<T>(count), param_binds.data(), count, v)) {
+				return false;
 			}
+			first += (std::min)(count, rest);
+		}
+		return true;
+	}
+
+	/*
+	* 写操作成功后调用
+	* 事务中的修改在提交前其他连接看不到，提交或回滚时再使一次缓存失效
+	*/
+	void invalidate_cache(std::string_view table) {
+		manjusaka::result_cache::instance().invalidate(table);
+		if (in_transaction()) {
+			dirty_tables_.push_back(table);
+		}
+	}
+
+	//不知道修改了哪些表
+	void invalidate_cache() {
+		manjusaka::result_cache::instance().invalidate_all();
+		if (in_transaction()) {
+			dirty_all_ = true;
 		}
-		else if constexpr (std::is_arithmetic_v<U>) { //жǷͣЩ
-			param.buffer_type = (enum_field_types)manjusaka::type_to_id(manjusaka::identity<U>{});
-			param.buffer = const_cast<void*>(static_cast<const void*>(&value));
+	}
+
+	void flush_dirty_tables() {
+		auto& cache = manjusaka::result_cache::instance();
+		for (auto table : dirty_tables_) {
+			cache.invalidate(table);
 		}
-		else if constexpr (std::is_same_v<std::string, U>) { //ǷΪַ
-			param.buffer_type = MYSQL_TYPE_STRING;
-			param.buffer = (void*)(value.c_str());
-			param.buffer_length = (unsigned long)value.size();
+		if (dirty_all_) {
+			cache.invalidate_all();
 		}
-		else if constexpr (std::is_same_v<const char*, U> or manjusaka::is_char_array_v<U>) { //ǷΪarray
-			param.buffer_type = MYSQL_TYPE_VARCHAR; //
-			param.buffer = (void*)(value);
-			param.buffer_length = (unsigned long)strlen(value);
+		dirty_tables_.clear();
+		dirty_all_ = false;
+	}
+
+	using phase = manjusaka::statement_phase;
+
+	//记录一个阶段的耗时，失败时记录错误码，返回ok
+	bool lap(manjusaka::statement_probe& probe, phase p, bool ok) {
+		probe.lap(p);
+		if (!ok) {
+			probe.error(error_code());
+		}
+		return ok;
+	}
+
+	//prepare也算一个阶段，失败时句柄已经关闭，错误码由prepare_statement在关闭前取出
+	bool lap_prepare(manjusaka::statement_probe& probe, std::string_view sql) {
+		unsigned int code = 0;
+		bool ok = prepare_statement(sql, &code) != nullptr;
+		probe.lap(phase::prepare);
+		if (!ok) {
+			probe.error(code);
 		}
-		else if constexpr (std::is_same_v<manjusaka::blob, U>) { //ǷΪvector<char>
-			param.buffer_type = MYSQL_TYPE_BLOB;
-			param.buffer = (void*)(value.data());
-			param.buffer_length = (unsigned long)value.size();
+		return ok;
+	}
+
+	//当前语句或者连接上的错误码，没有发送到服务端的错误为0
+	unsigned int error_code() const {
+		return stmt_ != nullptr ? mysql_stmt_errno(stmt_) : mysql_errno(con_);
+	}
+
+	//执行不带参数的sql，整个往返记在execute
+	bool text_query(std::string_view sql) {
+		manjusaka::statement_probe probe(sql);
+		if (!lap(probe, phase::execute, mysql_real_query(con_, sql.data(), (unsigned long)sql.size()) == 0)) {
+			return false;
 		}
-		else {
-			//ͻδ֧
+
+		uint64_t rows = mysql_affected_rows(con_);
+		probe.rows(rows == (uint64_t)-1 ? 0 : rows);
+		return true;
+	}
+
+	//参数个数和语句中?的个数不一致时mysql_stmt_bind_param会越界读取，先检查
+	bool bind_params(MYSQL_BIND* param_binds, size_t param_count) {
+		if (mysql_stmt_param_count(stmt_) != param_count) {
+			return false;
 		}
 
-		param_binds.push_back(param);
+		return param_count == 0 || !mysql_stmt_bind_param(stmt_, param_binds);
 	}
 
-	//ִв
+	//执行插入
 	template<typename T>
 	int stmt_execute(const T& t) {
-		std::vector<MYSQL_BIND>param_binds;
-
-		manjusaka::forEach(t, [&](auto&& fieldName, auto&& value) {
-			set_param_bind(param_binds, value);
-		});
+		std::array<MYSQL_BIND, T::field_count> param_binds;
+		manjusaka::param_layout<T>::bind(t, param_binds.data());
 
 		if (mysql_stmt_bind_param(stmt_, &param_binds[0])) {
 			return -1;
@@ -452,38 +1075,281 @@ private:
 		return count;
 	}
 
-	struct guard_statement {
-		guard_statement(MYSQL_STMT* stmt) :stmt_(stmt) {};
-		~guard_statement() {
-			if (stmt_ != nullptr) {
-				status_ = mysql_stmt_close(stmt_); //statusֵ
+	//insert和upsert的分块执行，upsert为true时生成on duplicate key update
+	template<typename T>
+	int execute_chunks(const std::vector<T>& t, bool upsert) {
+		if (t.empty()) {
+			return 0;
+		}
+
+		//一条语句最多65535个占位符
+		constexpr size_t size = T::field_count;
+		const size_t max_rows = (std::max)((size_t)1, (std::min)(batch_rows_, (size_t)65535 / size));
+		const size_t max_bytes = get_max_allowed_packet();
+
+		//原子操作，保证批量操作都完成
+		bool b = begin();
+		if (!b) {
+			return -1;
+		}
+
+		//整块复用同一个bind数组，每行只改写缓冲区地址
+		std::vector<MYSQL_BIND> param_binds;
+		param_binds.reserve((std::min)(max_rows, t.size()) * size);
+
+		int count = 0;
+		size_t first = 0;
+		while (first < t.size()) {
+			size_t last = first;
+			size_t bytes = packet_header_size;
+			while (last < t.size() && last - first < max_rows) {
+				size_t row_bytes = estimate_row_size(t[last]);
+				if (last > first && bytes + row_bytes > max_bytes) {
+					break;
+				}
+				bytes += row_bytes;
+				last++;
 			}
 
-			//TODO:־¼Ϣ	if (status_) LOG_ERROR << ...
+			int r = stmt_execute(t, first, last, param_binds, upsert, bytes);
+			if (r < 0) {
+				rollback();
+				return -1;
+			}
+			count += r;
+			first = last;
 		}
 
-		int status_{ 0 };
-		MYSQL_STMT* stmt_{ nullptr };
-	};
+		invalidate_cache(T::TABLE_NAME());
+		b = commit();
 
+		return b ? count : -1;
+	}
 
-	int get_blob_len(int col) {
-		unsigned long data_len = 0;
+	//执行多行插入，t[first, last)的参数依次排在同一个bind数组里
+	template<typename T>
+	int stmt_execute(const std::vector<T>& t, size_t first, size_t last,
+		std::vector<MYSQL_BIND>& param_binds, bool upsert, size_t bytes) {
+		std::string sql = upsert ? manjusaka::generate_upsert_sql<T>(last - first)
+			: manjusaka::generate_insert_sql<T>(last - first);
+		manjusaka::statement_probe probe(sql);
+		if (!lap_prepare(probe, sql)) {
+			return -1;
+		}
 
-		MYSQL_BIND param;
-		memset(&param, 0, sizeof(MYSQL_BIND));
-		param.length = &data_len;
-		param.buffer_type = MYSQL_TYPE_BLOB;
+		auto guard = guard_statement(this, sql);
 
-		auto retcode = mysql_stmt_fetch_column(stmt_, &param, col, 0);
-		if (retcode != 0) {
-			//error
-			return 0;
+		constexpr size_t size = T::field_count;
+		param_binds.resize((last - first) * size);
+		for (size_t i = first; i < last; i++) {
+			manjusaka::param_layout<T>::bind(t[i], &param_binds[(i - first) * size]);
+		}
+
+		probe.bytes_sent(bytes);
+		if (!lap(probe, phase::execute, !mysql_stmt_bind_param(stmt_, &param_binds[0]) &&
+			!mysql_stmt_execute(stmt_))) {
+			return -1;
+		}
+
+		//upsert的影响行数和行数没有对应关系
+		int count = (int)mysql_stmt_affected_rows(stmt_);
+		probe.rows(count);
+		if (!upsert && count != (int)(last - first)) {
+			return -1;
+		}
+
+		return count;
+	}
+
+	//估算一行在COM_STMT_EXECUTE包中占的字节数：2字节类型 + 长度前缀 + 数据
+	template<typename T>
+	size_t estimate_row_size(const T& t) {
+		size_t bytes = 0;
+		manjusaka::forEach(t, [&](auto&& fieldName, auto&& value) {
+			bytes += estimate_bind_size(value);
+		});
+		return bytes;
+	}
+
+	template<typename T>
+	static size_t estimate_bind_size(const T& value) {
+		using U = std::remove_const_t<std::remove_reference_t<T>>;
+		if constexpr (manjusaka::is_optional_v<U>) {
+			return value.has_value() ? estimate_bind_size(*value) : 2;
+		}
+		else if constexpr (std::is_arithmetic_v<U>) {
+			return 2 + sizeof(U);
+		}
+		else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<manjusaka::blob, U>) {
+			return 2 + 9 + value.size();
+		}
+		else if constexpr (std::is_same_v<const char*, U> or manjusaka::is_char_array_v<U>) {
+			return 2 + 9 + strlen(value);
+		}
+		else {
+			return 2;
+		}
+	}
+
+	//local infile的回调，userdata是mysql对象本身
+	static int infile_init(void** ptr, const char* filename, void* userdata) {
+		auto self = static_cast<mysql*>(userdata);
+		*ptr = self;
+		return self->infile_reader_ == nullptr ? 1 : 0;
+	}
+
+	static int infile_read(void* ptr, char* buf, unsigned int buf_len) {
+		auto self = static_cast<mysql*>(ptr);
+		return self->infile_reader_->read(buf, buf_len);
+	}
+
+	static void infile_end(void* ptr) {}
+
+	static int infile_error(void* ptr, char* error_msg, unsigned int error_msg_len) {
+		snprintf(error_msg, error_msg_len, "LOAD DATA LOCAL is only accepted from bulk_load");
+		return 2000; //CR_UNKNOWN_ERROR
+	}
+
+	//服务端的max_allowed_packet，每个连接只查一次
+	size_t get_max_allowed_packet() {
+		if (max_allowed_packet_ != 0) {
+			return max_allowed_packet_;
+		}
+
+		max_allowed_packet_ = 4 * 1024 * 1024; //查询失败时按5.7的默认值算
+		if (mysql_query(con_, "select @@max_allowed_packet") == 0) {
+			MYSQL_RES* res = mysql_store_result(con_);
+			if (res != nullptr) {
+				MYSQL_ROW row = mysql_fetch_row(res);
+				if (row != nullptr && row[0] != nullptr) {
+					max_allowed_packet_ = std::strtoull(row[0], nullptr, 10);
+				}
+				mysql_free_result(res);
+			}
+		}
+		return max_allowed_packet_;
+	}
+
+	/*
+	* 从缓存中取出sql对应的预处理语句，未命中时prepare后放入缓存
+	* 自动重连后thread id会变化，此时旧的句柄在服务端已经失效，整个缓存作废
+	* 失败时句柄被关闭，错误码随之清除，需要时通过error取得
+	*/
+	MYSQL_STMT* prepare_statement(std::string_view sql, unsigned int* error = nullptr) {
+		unsigned long thread_id = mysql_thread_id(con_);
+		if (thread_id != thread_id_) {
+			stmt_cache_.clear();
+			thread_id_ = thread_id;
+		}
+
+		stmt_ = stmt_cache_.get(sql);
+		if (stmt_ != nullptr) {
+			return stmt_;
+		}
+
+		stmt_ = mysql_stmt_init(con_);
+		if (!stmt_) {
+			if (error != nullptr) {
+				*error = mysql_errno(con_);
+			}
+			return nullptr;
+		}
+
+		if (mysql_stmt_prepare(stmt_, sql.data(), (unsigned long)sql.size())) {
+			if (error != nullptr) {
+				*error = mysql_stmt_errno(stmt_);
+			}
+			mysql_stmt_close(stmt_);
+			stmt_ = nullptr;
+			return nullptr;
+		}
+
+		stmt_cache_.put(sql, stmt_);
+		return stmt_;
+	}
+
+	/*
+	* 游标会长时间占用语句，期间把它从缓存中取出，避免被淘汰后关闭
+	* 用完后放回缓存，出错或者期间发生了重连则直接关闭
+	*/
+	MYSQL_STMT* checkout_statement(std::string_view sql) {
+		if (!prepare_statement(sql)) {
+			return nullptr;
+		}
+
+		MYSQL_STMT* stmt = stmt_cache_.take(sql);
+		stmt_ = nullptr;
+		return stmt;
+	}
+
+	void checkin_statement(std::string_view sql, MYSQL_STMT* stmt) {
+		if (con_ == nullptr || mysql_thread_id(con_) != thread_id_ || mysql_stmt_errno(stmt) != 0) {
+			mysql_stmt_close(stmt);
+			return;
+		}
+
+		mysql_stmt_free_result(stmt);
+		unsigned long type = CURSOR_TYPE_NO_CURSOR;
+		mysql_stmt_attr_set(stmt, STMT_ATTR_CURSOR_TYPE, &type);
+		stmt_cache_.put(sql, stmt);
+	}
+
+	//select id, name from `Person` ...，有成员不是反射字段时返回空串，prepare会失败
+	template<auto... Members>
+	static std::string make_projection_sql(const std::string& condition) {
+		using T = manjusaka::member_class_t<Members...>;
+		static_assert((std::is_same_v<T, typename manjusaka::member_traits<Members>::class_type> && ...),
+			"members must belong to the same class");
+
+		std::array<size_t, sizeof...(Members)> indices{ manjusaka::member_index<Members>()... };
+		for (size_t index : indices) {
+			if (index == T::field_count) {
+				return "";
+			}
 		}
-		return static_cast<int>(data_len);
+		return manjusaka::generate_select_fields_sql<T>(indices, condition);
 	}
 
-	//ɱչΪtuple
+	template<typename T>
+	static std::string make_select_sql(const std::string& condition) {
+		if constexpr (manjusaka::is_reflection_v<T>) {
+			return manjusaka::generate_select_sql<T>(condition);
+		}
+		else {
+			static_assert(manjusaka::is_tuple_v<T>);
+			return condition;
+		}
+	}
+
+	/*
+	* 语句用完后不再关闭，只释放结果集，句柄留在缓存里复用
+	* mysql_stmt_free_result会读完未取的行并关闭游标，下次execute前不必再reset
+	* 出错的句柄直接从缓存中删除，下次重新prepare
+	*/
+	struct guard_statement {
+		guard_statement(mysql* db, std::string_view sql) :db_(db), sql_(sql), stmt_(db->stmt_) {};
+		~guard_statement() {
+			if (stmt_ == nullptr) {
+				return;
+			}
+
+			if (mysql_stmt_errno(stmt_) != 0) {
+				//TODO:在日志记录错误信息	LOG_ERROR << mysql_stmt_error(stmt_)
+				db_->stmt_cache_.erase(sql_);
+			}
+			else {
+				mysql_stmt_free_result(stmt_);
+			}
+			db_->stmt_ = nullptr;
+		}
+
+		mysql* db_{ nullptr };
+		std::string_view sql_;
+		MYSQL_STMT* stmt_{ nullptr };
+	};
+
+
+	//将可变参数展开为tuple
 	template<typename... Args>
 	auto get_tuple(int& timeout, Args &&...args) {
 		auto tp = std::make_tuple(con_, std::forward<Args>(args)...);
@@ -503,8 +1369,18 @@ private:
 	}
 
 	MYSQL* con_{ nullptr };
-	MYSQL_STMT* stmt_{ nullptr }; //ʹԤӿٶ
+	MYSQL_STMT* stmt_{ nullptr }; //使用预处理加快速度
+	manjusaka::stmt_cache stmt_cache_;
+	unsigned long thread_id_{ 0 };
+	size_t batch_rows_{ 1000 };
+	size_t max_allowed_packet_{ 0 };
+	manjusaka::infile_reader* infile_reader_{ nullptr }; //bulk_load执行期间有效
+	std::vector<char> result_buffer_; //query_impl的结果缓冲区
+	static constexpr size_t packet_header_size = 1024; //包头、null bitmap等留出的余量
 	std::chrono::system_clock::time_point aliveTime_{ std::chrono::system_clock::now() };
+	bool use_result_cache_{ false };
+	std::vector<std::string_view> dirty_tables_; //事务中修改过的表，TABLE_NAME()是静态字符串
+	bool dirty_all_{ false };
 	bool has_error_{ false };
 };
 
@@ -3,6 +3,7 @@
 
 #include<optional>
 #include<string>
+#include<array>
 #include "reflection.hpp"
 
 namespace manjusaka {
@@ -21,78 +22,315 @@ namespace manjusaka {
         sql += " ";
     }
 
-    //ɽͬ͵ַƴһ
+    //可将不同类型的字符串拼接在一起
     template<typename... Args>
     inline void append(std::string& sql, Args &&... args) {
         (append_impl(sql, std::forward<Args>(args)), ...);
     }
 
-    //+ţжһǷǷ
-    //mysqlмӲӶûӰ
-    template<typename T,typename = std::enable_if_t<manjusaka::is_reflection_v<T>>>
-    inline std::string get_name() {
-        std::string quota_name = "`" + std::string(T::TABLE_NAME()) + "`";
-        return quota_name;
+    /*
+     * 编译期生成的sql，存放在静态存储区，运行时不分配内存
+     * 同一个类型的sql地址和内容都固定，可以直接作为语句缓存的键
+     * */
+    template<size_t N>
+    struct fixed_sql {
+        char data[N + 1]{};
+
+        constexpr std::string_view view() const { return { data, N }; }
+    };
+
+    //out为nullptr时只计算长度
+    struct sql_writer {
+        char* out{ nullptr };
+        size_t size{ 0 };
+
+        constexpr sql_writer& operator<<(std::string_view s) {
+            for (char c : s) {
+                if (out != nullptr) {
+                    out[size] = c;
+                }
+                size++;
+            }
+            return *this;
+        }
+    };
+
+    //先跑一遍Write得到长度，再写进fixed_sql
+    template<auto Write>
+    inline constexpr auto make_fixed_sql() {
+        constexpr size_t size = [] {
+            sql_writer w;
+            Write(w);
+            return w.size;
+        }();
+
+        fixed_sql<size> sql{};
+        sql_writer w{ sql.data };
+        Write(w);
+        return sql;
     }
 
+    //各语句中只和类型有关的部分
     template<typename T>
-    inline std::string generate_insert_sql() {
-        std::string sql = "insert into ";
-        //insert into Person ( id, name, age ) values( ?, ?, ?);
-        constexpr size_t size = T::field_count;
-        std::string table_name = get_name<T>();
-        constexpr std::string_view fields = T::field_list;
-        append(sql, table_name.data(), "(", fields.data(), ")", "values(");
-
-        for (size_t i = 0; i < size; i++) {
-            sql += "?";
-            if (i < size - 1) {
-                sql += ", ";
+    struct sql_parts {
+        //给表名+引号，在mysql中加不加都没影响
+        static constexpr void table_name(sql_writer& w) {
+            w << "`" << T::TABLE_NAME() << "`";
+        }
+
+        //(?, ?, ?)
+        static constexpr void placeholders(sql_writer& w) {
+            w << "(";
+            for (size_t i = 0; i < T::field_count; i++) {
+                w << (i < T::field_count - 1 ? "?, " : "?)");
             }
-            else {
-                sql += ");";
+        }
+
+        //insert into `Person` ( id, name, age ) values
+        static constexpr void insert_prefix(sql_writer& w) {
+            w << "insert into ";
+            table_name(w);
+            w << " ( " << T::field_list << " ) values";
+        }
+
+        //insert into `Person` ( id, name, age ) values(?, ?, ?);
+        static constexpr void insert(sql_writer& w) {
+            insert_prefix(w);
+            placeholders(w);
+            w << ";";
+        }
+
+        //on duplicate key update id = values(id), name = values(name), age = values(age)
+        static constexpr void upsert_suffix(sql_writer& w) {
+            w << " on duplicate key update ";
+            constexpr auto& names = field_names_v<T>;
+            for (size_t i = 0; i < names.size(); i++) {
+                w << names[i] << " = values(" << names[i] << (i < names.size() - 1 ? "), " : ")");
             }
         }
+
+        //select id, name, age from `Person`
+        //列名写全，表结构中列的顺序变化或者新增列都不影响结果
+        static constexpr void select_all(sql_writer& w) {
+            w << "select " << T::field_list << " from ";
+            table_name(w);
+        }
+
+        //select id, name, age from `Person` where id = ?
+        static constexpr void select_by_key(sql_writer& w) {
+            select_all(w);
+            w << " where " << field_names_v<T>[primary_key_index_v<T>] << " = ?";
+        }
+
+        //select id, name, age from `Person` where id in (
+        static constexpr void select_in_prefix(sql_writer& w) {
+            select_all(w);
+            w << " where " << field_names_v<T>[primary_key_index_v<T>] << " in (";
+        }
+
+        static constexpr void delete_all(sql_writer& w) {
+            w << "delete from ";
+            table_name(w);
+        }
+
+        //load data local infile 'ormcpp' into table Person ... ( id, name, age )
+        //字段的分隔和转义用LOAD DATA的默认格式，character set binary表示不做字符集转换
+        static constexpr void load_data(sql_writer& w) {
+            w << "load data local infile 'ormcpp' into table ";
+            table_name(w);
+            w << " character set binary fields terminated by '\\t' escaped by '\\\\'"
+                << " lines terminated by '\\n' ( " << T::field_list << " )";
+        }
+    };
+
+    template<typename T>
+    struct fixed_sql_of {
+        static constexpr auto table_name = make_fixed_sql<&sql_parts<T>::table_name>();
+        static constexpr auto placeholders = make_fixed_sql<&sql_parts<T>::placeholders>();
+        static constexpr auto insert_prefix = make_fixed_sql<&sql_parts<T>::insert_prefix>();
+        static constexpr auto insert = make_fixed_sql<&sql_parts<T>::insert>();
+        static constexpr auto upsert_suffix = make_fixed_sql<&sql_parts<T>::upsert_suffix>();
+        static constexpr auto select_all = make_fixed_sql<&sql_parts<T>::select_all>();
+        static constexpr auto select_by_key = make_fixed_sql<&sql_parts<T>::select_by_key>();
+        static constexpr auto select_in_prefix = make_fixed_sql<&sql_parts<T>::select_in_prefix>();
+        static constexpr auto delete_all = make_fixed_sql<&sql_parts<T>::delete_all>();
+        static constexpr auto load_data = make_fixed_sql<&sql_parts<T>::load_data>();
+    };
+
+    template<typename T,typename = std::enable_if_t<manjusaka::is_reflection_v<T>>>
+    inline constexpr std::string_view get_name() {
+        return fixed_sql_of<T>::table_name.view();
+    }
+
+    template<typename T>
+    inline constexpr std::string_view generate_insert_sql() {
+        return fixed_sql_of<T>::insert.view();
+    }
+
+    //多行插入
+    //insert into Person ( id, name, age ) values(?, ?, ?),(?, ?, ?);
+    template<typename T>
+    inline std::string generate_insert_sql(size_t rows) {
+        constexpr std::string_view prefix = fixed_sql_of<T>::insert_prefix.view();
+        constexpr std::string_view row = fixed_sql_of<T>::placeholders.view();
+
+        std::string sql;
+        sql.reserve(prefix.size() + rows * (row.size() + 1));
+        sql += prefix;
+        for (size_t i = 0; i < rows; i++) {
+            sql += row;
+            sql += i < rows - 1 ? "," : ";";
+        }
         return sql;
     }
 
+    //select id, name, age from `Person` where id in (?, ?, ?)
     template<typename T>
-    inline std::string generate_delete_sql(const std::string& where_condition = "") {
-        std::string sql = "delete from ";
-        std::string table_name = get_name<T>();
-        append(sql, table_name.data());
-        if (!where_condition.empty()) {
-            append(sql, "where", where_condition);
+    inline std::string generate_select_in_sql(size_t count) {
+        constexpr std::string_view prefix = fixed_sql_of<T>::select_in_prefix.view();
+        std::string sql;
+        sql.reserve(prefix.size() + count * 3);
+        sql += prefix;
+        for (size_t i = 0; i < count; i++) {
+            sql += i < count - 1 ? "?, " : "?)";
+        }
+        return sql;
+    }
+
+    template<typename T>
+    inline constexpr std::string_view generate_load_data_sql() {
+        return fixed_sql_of<T>::load_data.view();
+    }
+
+    //固定的前缀后面接上条件，只分配一次
+    inline std::string concat_condition(std::string_view prefix, std::string_view keyword,
+        std::string_view condition) {
+        std::string sql;
+        if (condition.empty()) {
+            sql = prefix;
+            return sql;
+        }
+
+        sql.reserve(prefix.size() + keyword.size() + condition.size() + 2);
+        sql += prefix;
+        sql += ' ';
+        if (!keyword.empty()) {
+            sql += keyword;
+            sql += ' ';
         }
+        sql += condition;
         return sql;
     }
 
     /*
-     * ֹwhere, order byҪconditionһ
-     * ע⴫˳ȴٴѯֶ
+     * 带占位符的条件，参数按顺序以二进制方式绑定，不拼进sql
+     * 不同的取值生成同样的sql，共用一个预处理语句
+     * where("age > ? and name = ?")
+     * */
+    struct where_condition {
+        std::string sql;
+    };
+
+    inline where_condition where(std::string_view condition) {
+        where_condition c;
+        c.sql.reserve(condition.size() + 6);
+        c.sql += "where ";
+        c.sql += condition;
+        return c;
+    }
+
+    //第一个参数是否为where_condition，用来区分原来拼接字符串的重载
+    template<typename... Args>
+    struct is_where_first : std::false_type {};
+
+    template<typename First, typename... Args>
+    struct is_where_first<First, Args...>
+        : std::is_same<where_condition, std::remove_cv_t<std::remove_reference_t<First>>> {};
+
+    template<typename... Args>
+    static constexpr bool is_where_first_v = is_where_first<Args...>::value;
+
+    template<typename T>
+    inline std::string generate_delete_sql(const std::string& where_condition = "") {
+        return concat_condition(fixed_sql_of<T>::delete_all.view(), "where", where_condition);
+    }
+
+    /*
+     * 不止有where, 还有order by等条件要和其他condition区别一下
+     * 注意传参顺序，先传条件，再传查询字段，"*"表示反射的全部字段
      * */
     template<typename T>
     inline std::string generate_select_sql(const std::string& select_condition, const std::string& select_fields = "*") {
+        if (select_fields == "*") {
+            return concat_condition(fixed_sql_of<T>::select_all.view(), "", select_condition);
+        }
+
         std::string sql = "select ";
-        std::string table_name = get_name<T>();
-        append(sql, select_fields, "from", table_name);
+        append(sql, select_fields, "from", get_name<T>());
         if (!select_condition.empty()) {
             append(sql, select_condition);
         }
         return sql;
     }
 
+    //只查询部分字段，indices是字段在DEFINE_TABLE中的下标
+    //select id, name from Person where age > 18
+    template<typename T, size_t N>
+    inline std::string generate_select_fields_sql(const std::array<size_t, N>& indices,
+        const std::string& select_condition) {
+        std::string fields;
+        for (size_t i = 0; i < N; i++) {
+            if (i > 0) {
+                fields += ", ";
+            }
+            fields += field_names_v<T>[indices[i]];
+        }
+        return generate_select_sql<T>(select_condition, fields);
+    }
+
     template<typename T>
     inline std::string generate_update_sql(const std::string& set_field, const std::string& where_condition = "") {
         std::string sql = "update ";
-        std::string table_name = get_name<T>();
-        append(sql, table_name, "set", set_field);
+        append(sql, get_name<T>(), "set", set_field);
         if (!where_condition.empty()) {
             append(sql, "where", where_condition);
         }
         return sql;
     }
 
+    //update Person set name = ?, age = ? where id = ?
+    //key字段放在最后，参数按字段顺序绑定后把key移到末尾即可
+    template<typename T>
+    inline std::string generate_update_by_key_sql(size_t key) {
+        constexpr auto& names = field_names_v<T>;
+        std::string set_field;
+        for (size_t i = 0; i < names.size(); i++) {
+            if (i == key) {
+                continue;
+            }
+            if (!set_field.empty()) {
+                set_field += ", ";
+            }
+            set_field += names[i];
+            set_field += " = ?";
+        }
+
+        std::string where_condition = std::string(names[key]) + " = ?";
+        return generate_update_sql<T>(set_field, where_condition);
+    }
+
+    //insert into Person ( id, name, age ) values(?, ?, ?),(?, ?, ?) on duplicate key update id = values(id), ...;
+    template<typename T>
+    inline std::string generate_upsert_sql(size_t rows) {
+        constexpr std::string_view suffix = fixed_sql_of<T>::upsert_suffix.view();
+        std::string sql = generate_insert_sql<T>(rows);
+        sql.pop_back(); //去掉结尾的分号
+        sql.reserve(sql.size() + suffix.size() + 1);
+        sql += suffix;
+        sql += ';';
+        return sql;
+    }
+
     template<typename T>
     inline constexpr auto to_str(T&& t) {
         if constexpr (std::is_arithmetic_v<std::decay_t<T>>) {
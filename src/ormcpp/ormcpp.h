@@ -5,7 +5,23 @@
 #include"operation.hpp"
 #include"reflection.hpp"
 #include"type_mapping.hpp"
+#include"stmt_cache.hpp"
+#include"load_data.hpp"
+#include"result_binder.hpp"
+#include"param_binder.hpp"
+#include"text_protocol.hpp"
+#include"event_loop.hpp"
+#include"async_mysql.hpp"
+#include"result_cache.hpp"
+#include"identity_map.hpp"
+#include"column_set.hpp"
+#include"result_set.hpp"
 #include"connection_pool.hpp"
+#include"routing_pool.hpp"
+#include"parallel_query.hpp"
+#include"bulk_writer.hpp"
+#include"memory_db.hpp"
+#include"statement_stats.hpp"
 
 template<typename DB>
 using ormcpp= manjusaka::connection_pool<DB>;
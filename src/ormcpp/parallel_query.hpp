@@ -0,0 +1,227 @@
+#ifndef PARALLEL_QUERY_H
+#define PARALLEL_QUERY_H
+
+#include<mutex>
+#include<string>
+#include<thread>
+#include<vector>
+#include<tuple>
+#include<iterator>
+#include<optional>
+#include<type_traits>
+
+#include"reflection.hpp"
+#include"connection_pool.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 并行查询的选项
+	* partitions : 主键范围切成几段，每段一个连接一个线程，不要超过连接池的max_total
+	* filter : 额外的条件，不带where，例如"age > 18"，每段都会加上
+	* key_order : 为true时每段按主键排序，结果按段的顺序拼接，整体有序
+	*/
+	struct parallel_options {
+		size_t partitions{ 4 };
+		std::string filter;
+		bool key_order{ false };
+	};
+
+	/*
+	* 一段的执行情况，范围是[first, last]，ok为false时这一段的数据不完整
+	* 查询主键范围失败时没有办法分段，结果中只有一个ok为false、范围为空的段
+	*/
+	template<typename T>
+	struct partition_status {
+		primary_key_t<T> first{};
+		primary_key_t<T> last{};
+		size_t rows{ 0 };
+		bool ok{ false };
+	};
+
+	template<typename T>
+	struct parallel_result {
+		std::vector<T> rows;
+		std::vector<partition_status<T>> partitions;
+
+		bool ok() const {
+			for (auto& p : partitions) {
+				if (!p.ok) {
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	namespace detail {
+		template<typename T>
+		inline std::string key_name() {
+			return std::string(field_names_v<T>[primary_key_index_v<T>]);
+		}
+
+		inline std::string filter_condition(const parallel_options& opt) {
+			return opt.filter.empty() ? std::string() : "where " + opt.filter;
+		}
+
+		/*
+		* 查询主键的最小最大值，把[min, max]尽量平均地切成partitions段
+		* 表为空时没有分段，查询出错时返回false
+		*/
+		template<typename T, typename DB>
+		bool split_key_range(connection_pool<DB>& pool, const parallel_options& opt,
+			std::vector<partition_status<T>>& parts) {
+			using key_type = primary_key_t<T>;
+			static_assert(std::is_integral_v<key_type>, "parallel query needs an integral primary key");
+
+			auto con = pool.get();
+			if (!con) {
+				return false;
+			}
+
+			std::string key = key_name<T>();
+			std::string sql = "select min(" + key + "), max(" + key + ") from " +
+				std::string(get_name<T>()) + " " + filter_condition(opt);
+			auto range = con->template query<std::tuple<std::optional<key_type>, std::optional<key_type>>>(sql);
+			if (range.size() != 1) {
+				return false;
+			}
+
+			auto [min, max] = range.front();
+			if (!min || !max) {
+				return true;
+			}
+
+			//差值可能超出有符号类型的范围，用无符号计算
+			uint64_t span = (uint64_t)*max - (uint64_t)*min;
+			uint64_t count = (std::max)((size_t)1, opt.partitions);
+			if (span < count) {
+				count = span + 1;
+			}
+
+			//一共span + 1个值，每段width个，前rest + 1段多一个
+			uint64_t width = span / count;
+			uint64_t rest = span % count;
+			uint64_t first = (uint64_t)*min;
+			for (uint64_t i = 0; i < count; i++) {
+				uint64_t last = i <= rest ? first + width : first + width - 1;
+
+				partition_status<T> p;
+				p.first = (key_type)first;
+				p.last = (key_type)last;
+				parts.push_back(p);
+				first = last + 1;
+			}
+			return true;
+		}
+
+		template<typename T>
+		inline std::string partition_condition(const parallel_options& opt, const partition_status<T>& p) {
+			std::string key = key_name<T>();
+			std::string condition = "where " + key + " >= " + std::to_string(p.first) +
+				" and " + key + " <= " + std::to_string(p.last);
+			if (!opt.filter.empty()) {
+				condition += " and (" + opt.filter + ")";
+			}
+			if (opt.key_order) {
+				condition += " order by " + key;
+			}
+			return condition;
+		}
+
+		/*
+		* 每段一个线程，各自从连接池借一个连接，用游标逐行读取
+		* 每读到一行调用f(i, row)，一段结束后调用done(i)
+		*/
+		template<typename T, typename DB, typename F, typename D>
+		void run_partitions(connection_pool<DB>& pool, const parallel_options& opt,
+			std::vector<partition_status<T>>& parts, F&& f, D&& done) {
+			std::vector<std::thread> workers;
+			workers.reserve(parts.size());
+			for (size_t i = 0; i < parts.size(); i++) {
+				workers.emplace_back([&, i] {
+					partition_status<T>& p = parts[i];
+					auto con = pool.get();
+					if (con) {
+						p.ok = con->template for_each_row<T>(partition_condition(opt, p), [&](T& row) {
+							p.rows++;
+							f(i, row);
+						});
+					}
+					done(i);
+				});
+			}
+
+			for (auto& t : workers) {
+				t.join();
+			}
+		}
+	}
+
+	/*
+	* 按主键范围把全表查询切成多段，在连接池的多个连接上同时执行
+	* 主键必须是整数，范围按min/max平均切分，数据分布不均匀时各段的行数也不均匀
+	* 不要求顺序时先完成的段先放进结果，key_order时按主键排序
+	* 查询主键范围失败时partitions中只有一个失败的段，ok()为false；表为空时partitions为空，ok()为true
+	*
+	* auto r = manjusaka::parallel_query<Person>(ormcpp<mysql>::instance(), { 8 });
+	*/
+	template<typename T, typename DB>
+	parallel_result<T> parallel_query(connection_pool<DB>& pool, const parallel_options& opt = {}) {
+		parallel_result<T> result;
+		std::vector<partition_status<T>> parts;
+		if (!detail::split_key_range<T>(pool, opt, parts)) {
+			result.partitions.assign(1, partition_status<T>{});
+			return result;
+		}
+
+		//每段写自己的数组，只有记录完成顺序时需要加锁
+		std::vector<std::vector<T>> chunks(parts.size());
+		std::vector<size_t> done;
+		std::mutex mtx;
+		detail::run_partitions<T>(pool, opt, parts,
+			[&](size_t i, T& row) { chunks[i].push_back(std::move(row)); },
+			[&](size_t i) {
+				std::lock_guard<std::mutex> lock(mtx);
+				done.push_back(i);
+			});
+
+		if (opt.key_order) {
+			done.clear();
+			for (size_t i = 0; i < parts.size(); i++) {
+				done.push_back(i);
+			}
+		}
+
+		size_t total = 0;
+		for (auto& chunk : chunks) {
+			total += chunk.size();
+		}
+		result.rows.reserve(total);
+		for (size_t i : done) {
+			std::move(chunks[i].begin(), chunks[i].end(), std::back_inserter(result.rows));
+		}
+		result.partitions = std::move(parts);
+		return result;
+	}
+
+	/*
+	* 流式版本，每读到一行调用f(partition, row)，不保存结果
+	* f会在各段的线程中同时调用，需要自己保证线程安全；同一段内按读到的顺序调用
+	* 返回值和parallel_result::partitions相同，查询主键范围失败时只有一个失败的段
+	*/
+	template<typename T, typename DB, typename F>
+	std::vector<partition_status<T>> parallel_for_each(connection_pool<DB>& pool, F&& f,
+		const parallel_options& opt = {}) {
+		std::vector<partition_status<T>> parts;
+		if (!detail::split_key_range<T>(pool, opt, parts)) {
+			parts.assign(1, partition_status<T>{});
+			return parts;
+		}
+
+		detail::run_partitions<T>(pool, opt, parts, f, [](size_t) {});
+		return parts;
+	}
+}
+
+#endif //PARALLEL_QUERY_H
@@ -0,0 +1,112 @@
+#ifndef PARAM_BINDER_H
+#define PARAM_BINDER_H
+
+#include<array>
+#include<string>
+#include<string.h>
+#include<utility>
+#include<mysql/mysql.h>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 参数的MYSQL_BIND中只和类型有关的部分，编译期就能确定
+	* optional按内部类型绑定，为空时再把buffer_type改成MYSQL_TYPE_NULL
+	*/
+	template<typename U>
+	inline constexpr MYSQL_BIND make_param_bind() {
+		MYSQL_BIND bind{};
+		if constexpr (is_optional_v<U>) {
+			return make_param_bind<typename U::value_type>();
+		}
+		else if constexpr (std::is_arithmetic_v<U>) {
+			bind.buffer_type = (enum_field_types)type_to_id(identity<U>{});
+			bind.is_unsigned = std::is_unsigned_v<U>;
+		}
+		else if constexpr (std::is_same_v<blob, U>) {
+			bind.buffer_type = MYSQL_TYPE_BLOB;
+		}
+		else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<std::string_view, U> or
+			std::is_same_v<const char*, U> or is_char_array_v<U> or is_char_std_array_v<U>) {
+			bind.buffer_type = MYSQL_TYPE_STRING;
+		}
+		else {
+			static_assert(sizeof(U) == 0, "type is not supported as a statement parameter");
+		}
+		return bind;
+	}
+
+	//每次执行只需要填写缓冲区地址和长度，不分配内存
+	template<typename U>
+	inline void set_param_buffer(MYSQL_BIND& bind, const U& value) {
+		if constexpr (is_optional_v<U>) {
+			if (value.has_value()) {
+				set_param_buffer(bind, *value);
+			}
+			else {
+				bind.buffer_type = MYSQL_TYPE_NULL;
+			}
+		}
+		else if constexpr (std::is_arithmetic_v<U>) {
+			bind.buffer = const_cast<void*>(static_cast<const void*>(&value));
+		}
+		else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<std::string_view, U> or
+			std::is_same_v<blob, U>) {
+			bind.buffer = (void*)(value.data());
+			bind.buffer_length = (unsigned long)value.size();
+		}
+		else if constexpr (is_char_std_array_v<U>) {
+			bind.buffer = (void*)(value.data());
+			bind.buffer_length = (unsigned long)strnlen(value.data(), value.size());
+		}
+		else if constexpr (is_char_array_v<U>) {
+			bind.buffer = (void*)(value);
+			bind.buffer_length = (unsigned long)strnlen(value, sizeof(U));
+		}
+		else if constexpr (std::is_same_v<const char*, U>) {
+			bind.buffer = (void*)(value);
+			bind.buffer_length = (unsigned long)strlen(value);
+		}
+	}
+
+	//按顺序绑定where条件中?对应的参数，args在语句执行完之前必须有效
+	template<typename... Args>
+	inline std::array<MYSQL_BIND, sizeof...(Args)> make_param_binds(const Args&... args) {
+		std::array<MYSQL_BIND, sizeof...(Args)> binds{
+			make_param_bind<std::remove_cv_t<std::remove_reference_t<Args>>>()... };
+		size_t index = 0;
+		(set_param_buffer(binds[index++], args), ...);
+		return binds;
+	}
+
+	/*
+	* 反射对象的参数绑定模板，每个类型在编译期生成一份
+	* 绑定一行时先拷贝模板，再逐个字段填写地址和长度
+	*/
+	template<typename T>
+	struct param_layout {
+		static constexpr size_t size = T::field_count;
+
+		template<size_t... Is>
+		static constexpr std::array<MYSQL_BIND, size> make(std::index_sequence<Is...>) {
+			return { make_param_bind<field_type_t<T, Is>>()... };
+		}
+
+		static constexpr std::array<MYSQL_BIND, size> binds = make(std::make_index_sequence<size>{});
+
+		//binds指向至少size个元素
+		static void bind(const T& t, MYSQL_BIND* binds_out) {
+			memcpy(binds_out, binds.data(), sizeof(binds));
+			size_t index = 0;
+			forEach(t, [&](auto&& fieldName, auto&& value) {
+				set_param_buffer(binds_out[index], value);
+				index++;
+			});
+		}
+	};
+}
+
+#endif //PARAM_BINDER_H
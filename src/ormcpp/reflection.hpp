@@ -21,7 +21,7 @@ namespace manjusaka {
         32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
         16, 15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1)
 
-    //ֱƴӻᵼ´󣬻Ҫװһ
+    //直接拼接会导致错误，还需要包装一下
 #define CONCAT(A, B) CONCAT1(A, B)
 #define CONCAT1(A, B) A##_##B
 
@@ -94,10 +94,10 @@ namespace manjusaka {
 #define REPEAT_64(func, i, arg, ...)  func(i, arg) REPEAT_63(func, i + 1, __VA_ARGS__)
 
 
-//ɲб
+//生成参数列表
 #define MAKE_LIST(...) #__VA_ARGS__,
 
-//PS: obj.argһҪ
+//PS: obj.arg一定要加括号
 #define DEFINE_FIELD(i, arg)                 \
 template<typename T>                         \
 struct FIELD<T, i>{                          \
@@ -119,6 +119,10 @@ static constexpr size_t field_count = GET_ARG_COUNT(__VA_ARGS__);              \
 CONCAT(REPEAT, GET_ARG_COUNT(__VA_ARGS__))(DEFINE_FIELD, 0, __VA_ARGS__)       \
 static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
 
+//在DEFINE_TABLE之后声明主键，没有声明时第一个字段就是主键
+#define DEFINE_PRIMARY_KEY(field)                                              \
+static constexpr std::string_view primary_key = STR(field);
+
     template<typename T, typename = void>
     struct is_reflection : std::false_type {};
 
@@ -141,11 +145,21 @@ static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
     constexpr bool is_char_array_v = std::is_array_v<T>
         && std::is_same_v<char, std::remove_pointer_t<std::decay_t<T>>>;
 
-    //Uһ
+    //VARCHAR(N)对应的std::array<char, N>
+    template<typename T>
+    struct is_char_std_array : std::false_type {};
+
+    template<size_t N>
+    struct is_char_std_array<std::array<char, N>> : std::true_type {};
+
+    template<typename T>
+    static constexpr bool is_char_std_array_v = is_char_std_array<T>::value;
+
+    //U是一个泛型
     template<template <typename...> class U, typename T>
     struct is_template_instant : std::false_type {};
 
-    //жĳǷĳͣ磺tuple<int, short> Ƿtuple vector<int> Ƿvector
+    //可用于判断某个泛型是否是某个类型，例如：tuple<int, short> 是否是tuple， vector<int> 是否是vector
     template<template <typename...> class U, typename... args>
     struct is_template_instant<U, U<args...>> : std::true_type {};
 
@@ -155,11 +169,42 @@ static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
     template<typename T>
     static constexpr bool is_tuple_v = is_tuple<T>::value;
 
+    //反射对象或tuple的字段个数
+    template<typename T, typename = void>
+    struct field_count_of : std::tuple_size<T> {};
+
+    template<typename T>
+    struct field_count_of<T, std::enable_if_t<is_reflection_v<T>>>
+        : std::integral_constant<size_t, T::field_count> {};
+
+    template<typename T>
+    static constexpr size_t field_count_of_v = field_count_of<T>::value;
+
+    //反射对象的字段名，和DEFINE_TABLE中的顺序一致
+    template<typename T, size_t... Is>
+    inline constexpr std::array<std::string_view, sizeof...(Is)> make_field_names(std::index_sequence<Is...>) {
+        return { std::string_view(T::template FIELD<T, Is>::name())... };
+    }
+
+    template<typename T>
+    static constexpr auto field_names_v = make_field_names<T>(std::make_index_sequence<T::field_count>{});
+
+    //按名字查找字段的下标，找不到时返回field_count
+    template<typename T>
+    inline constexpr size_t field_index(std::string_view name) {
+        for (size_t i = 0; i < T::field_count; i++) {
+            if (field_names_v<T>[i] == name) {
+                return i;
+            }
+        }
+        return T::field_count;
+    }
+
     /*
-     * fĲ
-     * 1.const char* ֶ
-     * 2. ֶεľֵ
-     * еÿֶζ뵽f
+     * f的参数：
+     * 1.const char* 字段名
+     * 2.任意类型 字段的具体值
+     * 将类中的每个字段都带入到f中
      * */
     /*template<typename T, typename F, size_t... Is>
     inline constexpr void forEach(T&& obj, F&& f, std::index_sequence<Is...>) {
@@ -177,8 +222,7 @@ static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
     template<typename T, typename F, size_t... Is>
     inline constexpr void forEach(T&& obj, F&& f, std::index_sequence<Is...>) {
         using TDECAY = std::decay_t<T>;
-        using U = std::remove_reference_t<T>;
-        if constexpr (is_tuple_v<U>) {
+        if constexpr (is_tuple_v<TDECAY>) {
             (f(std::get<Is>(std::forward<T>(obj))), ...);
         }
         else {
@@ -190,7 +234,7 @@ static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
     template<typename T, typename F>
     inline constexpr void forEach(T&& obj, F&& f) {
         using U = std::remove_reference_t<T>;
-        if constexpr (is_tuple_v<U>) {
+        if constexpr (is_tuple_v<std::decay_t<T>>) {
             forEach(std::forward<T>(obj),
                 std::forward<F>(f),
                 std::make_index_sequence<std::tuple_size_v<U>>{});
@@ -202,6 +246,88 @@ static constexpr std::string_view field_list = { MAKE_LIST(__VA_ARGS__) };
         }
     }
 
+    //反射对象第I个字段的类型
+    template<typename T, size_t I>
+    using field_type_t = std::remove_cv_t<std::remove_reference_t<
+        decltype(std::declval<typename T::template FIELD<T, I>>().value())>>;
+
+    //主键的下标和类型
+    template<typename T, typename = void>
+    struct primary_key_index : std::integral_constant<size_t, 0> {};
+
+    template<typename T>
+    struct primary_key_index<T, std::void_t<decltype(T::primary_key)>>
+        : std::integral_constant<size_t, field_index<T>(T::primary_key)> {
+        static_assert(field_index<T>(T::primary_key) < T::field_count, "primary key is not a field");
+    };
+
+    template<typename T>
+    static constexpr size_t primary_key_index_v = primary_key_index<T>::value;
+
+    template<typename T>
+    using primary_key_t = field_type_t<T, primary_key_index_v<T>>;
+
+    template<typename T>
+    inline const primary_key_t<T>& get_primary_key(const T& t) {
+        return typename T::template FIELD<const T, primary_key_index_v<T>>(t).value();
+    }
+
+    //成员指针所属的类和字段类型
+    template<auto Member>
+    struct member_traits;
+
+    template<typename C, typename V, V C::* Member>
+    struct member_traits<Member> {
+        using class_type = C;
+        using value_type = V;
+    };
+
+    //一组成员指针所属的类，以第一个为准
+    template<auto... Members>
+    struct member_class;
+
+    template<auto First, auto... Rest>
+    struct member_class<First, Rest...> {
+        using type = typename member_traits<First>::class_type;
+    };
+
+    template<auto... Members>
+    using member_class_t = typename member_class<Members...>::type;
+
+    /*
+     * 成员指针对应的字段下标，不是DEFINE_TABLE中的字段时为field_count
+     * 宏里没有成员指针，第一次调用时构造一个对象比较字段的地址，结果缓存下来
+     * */
+    template<auto Member>
+    inline size_t member_index() {
+        using C = typename member_traits<Member>::class_type;
+        static const size_t index = [] {
+            C probe{};
+            const void* target = &(probe.*Member);
+            size_t i = 0;
+            size_t found = C::field_count;
+            forEach(probe, [&](auto&& fieldName, auto&& value) {
+                if ((const void*)&value == target) {
+                    found = i;
+                }
+                i++;
+            });
+            return found;
+        }();
+        return index;
+    }
+
+    //反射对象和tuple统一按值遍历
+    template<typename T, typename F>
+    inline constexpr void for_each_value(T&& obj, F&& f) {
+        if constexpr (is_tuple_v<std::decay_t<T>>) {
+            forEach(std::forward<T>(obj), [&](auto&& value) { f(value); });
+        }
+        else {
+            forEach(std::forward<T>(obj), [&](auto&& fieldName, auto&& value) { f(value); });
+        }
+    }
+
     template<typename T>
     void serializeObj(std::ostream& out, const T& obj,
         const char* fieldName = "", int depth = 0) {
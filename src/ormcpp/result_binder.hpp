@@ -0,0 +1,321 @@
+#ifndef RESULT_BINDER_H
+#define RESULT_BINDER_H
+
+#include<array>
+#include<vector>
+#include<string>
+#include<string_view>
+#include<string.h>
+#include<algorithm>
+#include<ctype.h>
+#include<mysql/mysql.h>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 把预处理语句的结果绑定到T(反射对象或tuple)上
+	* 数值列绑定到内部的8字节槽里，字符串和blob列共用一块连续的缓冲区
+	* 缓冲区的大小按结果集元数据计算：
+	*   缓冲结果集(store_result)时用STMT_ATTR_UPDATE_MAX_LENGTH得到每列实际的最大长度
+	*   不缓冲时按列定义的长度分配，最多default_column_buffer字节
+	* 超出缓冲区的值用mysql_stmt_fetch_column补取，之后的行直接使用扩大后的缓冲区
+	* 数值列被截断(比如BIGINT读到int)时这一行读取失败，定长字符数组按设计截断
+	* 缓冲区由调用者提供，可以在多次查询之间复用
+	* 反射对象按列名(不区分大小写)对应字段，结果可以只包含部分字段，缺少的字段保持默认值
+	* tuple按位置对应，列数必须相同
+	* 内部的数组按结果集中列的位置(slot)存放，slot_of_记录每个字段对应的slot
+	*/
+	template<typename T>
+	class result_binder {
+	public:
+		static constexpr size_t size = field_count_of_v<T>;
+		static constexpr size_t default_column_buffer = 4096;
+		static constexpr size_t npos = size_t(-1);
+
+		explicit result_binder(std::vector<char>& buffer) : buffer_(buffer) {}
+
+		result_binder(const result_binder&) = delete;
+		result_binder& operator=(const result_binder&) = delete;
+
+		//在execute(缓冲时还有store_result)之后调用，列和T的字段对应不上时返回false
+		bool bind(MYSQL_STMT* stmt, bool buffered) {
+			stmt_ = stmt;
+			size_t columns = mysql_stmt_field_count(stmt);
+			if (size == 0 || columns == 0 || columns > size) {
+				return false;
+			}
+
+			MYSQL_RES* meta = mysql_stmt_result_metadata(stmt);
+			if (meta == nullptr) {
+				return false;
+			}
+
+			MYSQL_FIELD* fields = mysql_fetch_fields(meta);
+			if (!map_columns(fields, columns)) {
+				mysql_free_result(meta);
+				return false;
+			}
+
+			T probe{};
+			size_t index = 0;
+			for_each_value(probe, [&](auto&& value) {
+				if (slot_of_[index] != npos) {
+					init_column(slot_of_[index], value, fields[slot_of_[index]], buffered);
+				}
+				index++;
+			});
+			mysql_free_result(meta);
+
+			layout();
+			return !mysql_stmt_bind_result(stmt_, binds_.data());
+		}
+
+		/*
+		* 读取一行写入t
+		* 返回0表示成功，MYSQL_NO_DATA表示没有更多数据，1表示出错
+		*/
+		int fetch(T& t) {
+			int r = fetch_row();
+			if (r != 0) {
+				return r;
+			}
+
+			size_t index = 0;
+			for_each_value(t, [&](auto&& value) {
+				if (slot_of_[index] != npos) {
+					set_value(slot_of_[index], value);
+				}
+				index++;
+			});
+			return 0;
+		}
+
+		//只读取一行到缓冲区，不写入对象，之后用下面的函数直接访问各列，返回值和fetch相同
+		int fetch_row() {
+			int r = mysql_stmt_fetch(stmt_);
+			if (r == MYSQL_DATA_TRUNCATED) {
+				r = refetch_truncated() ? 0 : 1;
+			}
+			return r;
+		}
+
+		//以下参数都是字段的下标，结果中没有这个字段时当作NULL
+		bool is_null(size_t field) const {
+			return slot_of_[field] == npos || is_null_[slot_of_[field]];
+		}
+
+		//数值列的值，NULL时为0
+		template<typename U>
+		U scalar(size_t field) const {
+			return slot_of_[field] == npos ? U{} : scalar_at<U>(slot_of_[field]);
+		}
+
+		//字符串和blob列的数据，指向内部的缓冲区，下一次fetch后失效
+		std::string_view column(size_t field) const {
+			return slot_of_[field] == npos ? std::string_view() : column_at(slot_of_[field]);
+		}
+
+		//当前行各列数据的长度之和，NULL列为0
+		size_t row_bytes() const {
+			size_t bytes = 0;
+			for (size_t i = 0; i < size; i++) {
+				bytes += is_null_[i] ? 0 : lengths_[i];
+			}
+			return bytes;
+		}
+
+	private:
+		//建立字段到slot的对应关系，有列找不到字段或者重复时返回false
+		bool map_columns(const MYSQL_FIELD* fields, size_t columns) {
+			slot_of_.fill(npos);
+			if constexpr (is_reflection_v<T>) {
+				for (size_t i = 0; i < columns; i++) {
+					size_t field = find_field(fields[i].name);
+					if (field == size || slot_of_[field] != npos) {
+						return false;
+					}
+					slot_of_[field] = i;
+				}
+			}
+			else {
+				if (columns != size) {
+					return false;
+				}
+				for (size_t i = 0; i < columns; i++) {
+					slot_of_[i] = i;
+				}
+			}
+			return true;
+		}
+
+		static size_t find_field(std::string_view name) {
+			for (size_t i = 0; i < size; i++) {
+				std::string_view field = field_names_v<T>[i];
+				if (field.size() == name.size() && std::equal(field.begin(), field.end(), name.begin(),
+					[](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); })) {
+					return i;
+				}
+			}
+			return size;
+		}
+
+		template<typename U>
+		U scalar_at(size_t i) const {
+			U value{};
+			if (!is_null_[i]) {
+				memcpy(&value, &scalars_[i], sizeof(U));
+			}
+			return value;
+		}
+
+		std::string_view column_at(size_t i) const {
+			size_t len = is_null_[i] ? 0 : (std::min)((size_t)lengths_[i], capacity_[i]);
+			return { buffer_.data() + offsets_[i], len };
+		}
+
+		template<typename U>
+		void init_column(size_t i, U& value, const MYSQL_FIELD& field, bool buffered) {
+			MYSQL_BIND& bind = binds_[i];
+			bind = {};
+			bind.length = &lengths_[i];
+			bind.is_null = &is_null_[i];
+			bind.error = &errors_[i];
+			capacity_[i] = 0;
+			growable_[i] = false;
+
+			if constexpr (is_optional_v<U>) {
+				typename U::value_type inner{};
+				init_column(i, inner, field, buffered);
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				static_assert(sizeof(U) <= sizeof(uint64_t));
+				bind.buffer_type = (enum_field_types)type_to_id(identity<U>{});
+				bind.buffer = &scalars_[i];
+				bind.buffer_length = sizeof(U);
+				bind.is_unsigned = std::is_unsigned_v<U>;
+			}
+			else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<blob, U>) {
+				bind.buffer_type = std::is_same_v<blob, U> ? MYSQL_TYPE_BLOB : MYSQL_TYPE_STRING;
+				size_t len = buffered ? field.max_length
+					: (std::min)((size_t)field.length, default_column_buffer);
+				capacity_[i] = (std::max)(len, (size_t)1);
+				growable_[i] = true;
+			}
+			else if constexpr (is_char_array_v<U> or is_char_std_array_v<U>) {
+				//定长数组放不下的部分直接截断
+				bind.buffer_type = MYSQL_TYPE_STRING;
+				capacity_[i] = sizeof(U);
+			}
+			else {
+				static_assert(sizeof(U) == 0, "type is not supported by query");
+			}
+		}
+
+		//重新计算每列在buffer_中的位置
+		void layout() {
+			size_t total = 0;
+			for (size_t i = 0; i < size; i++) {
+				offsets_[i] = total;
+				total += capacity_[i];
+			}
+
+			if (buffer_.size() < total) {
+				buffer_.resize(total);
+			}
+
+			for (size_t i = 0; i < size; i++) {
+				if (capacity_[i] != 0) {
+					binds_[i].buffer = buffer_.data() + offsets_[i];
+					binds_[i].buffer_length = (unsigned long)capacity_[i];
+				}
+			}
+		}
+
+		/*
+		* 有列被截断时扩大对应的缓冲区并重新布局
+		* 布局变化后其他列的数据位置也变了，所以全部变长列都用mysql_stmt_fetch_column重新取一次
+		* 这一步只是从已经收到的行里拷贝，不会和服务端通信
+		* 数值列的截断没法补救，返回false，不能把错误的值当成结果
+		*/
+		bool refetch_truncated() {
+			bool grow = false;
+			for (size_t i = 0; i < size; i++) {
+				if (!errors_[i]) {
+					continue;
+				}
+
+				if (capacity_[i] == 0) { //数值列
+					return false;
+				}
+
+				if (growable_[i] && lengths_[i] > capacity_[i]) {
+					capacity_[i] = (std::max)((size_t)lengths_[i], capacity_[i] * 2);
+					grow = true;
+				}
+			}
+
+			if (!grow) {
+				return true;
+			}
+
+			layout();
+			for (size_t i = 0; i < size; i++) {
+				if (capacity_[i] != 0 && !is_null_[i]) {
+					if (mysql_stmt_fetch_column(stmt_, &binds_[i], (unsigned int)i, 0)) {
+						return false;
+					}
+				}
+			}
+
+			return !mysql_stmt_bind_result(stmt_, binds_.data());
+		}
+
+		template<typename U>
+		void set_value(size_t i, U& value) {
+			if constexpr (is_optional_v<U>) {
+				if (is_null_[i]) {
+					value.reset();
+				}
+				else {
+					set_value(i, value.emplace());
+				}
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				value = scalar_at<U>(i);
+			}
+			else {
+				std::string_view col = column_at(i);
+				const char* data = col.data();
+				size_t len = col.size();
+				if constexpr (std::is_same_v<std::string, U>) {
+					value.assign(data, len);
+				}
+				else if constexpr (std::is_same_v<blob, U>) {
+					value.assign(data, data + len);
+				}
+				else { //定长数组，剩余部分补0
+					char* dst = (char*)&value;
+					memcpy(dst, data, len);
+					memset(dst + len, 0, sizeof(U) - len);
+				}
+			}
+		}
+
+		MYSQL_STMT* stmt_{ nullptr };
+		std::vector<char>& buffer_;
+		std::array<MYSQL_BIND, size> binds_ = {};
+		std::array<unsigned long, size> lengths_ = {};
+		std::array<bool, size> is_null_ = {};
+		std::array<bool, size> errors_ = {};
+		std::array<bool, size> growable_ = {};
+		std::array<size_t, size> capacity_ = {};
+		std::array<size_t, size> offsets_ = {};
+		std::array<uint64_t, size> scalars_ = {};
+		std::array<size_t, size> slot_of_ = {};
+	};
+}
+
+#endif //RESULT_BINDER_H
@@ -0,0 +1,246 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include<list>
+#include<mutex>
+#include<array>
+#include<memory>
+#include<atomic>
+#include<chrono>
+#include<string>
+#include<vector>
+#include<string_view>
+#include<unordered_map>
+#include<mysql/mysql.h>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	/*
+	* ttl : 结果在缓存中保留的最长时间
+	* max_bytes : 所有分片加起来的内存上限，按估算的结果大小计算
+	* shard_count : 分片数，每个分片一把锁
+	*/
+	struct result_cache_config {
+		std::chrono::milliseconds ttl{ 1000 };
+		size_t max_bytes{ 64 * 1024 * 1024 };
+		size_t shard_count{ 16 };
+	};
+
+	/*
+	* 进程内的查询结果缓存，所有连接共用一份，线程安全
+	* 键是结果类型、sql和绑定参数的二进制值，值是整个结果数组
+	* 写操作按表名递增版本号，缓存项记录填充时的版本，版本不一致就当作失效，不需要遍历删除
+	* 表名按哈希映射到固定数量的版本号上，不同的表冲突时只会多一些未命中
+	*/
+	class result_cache {
+	public:
+		using clock = std::chrono::steady_clock;
+
+		static result_cache& instance() {
+			static result_cache instance;
+			return instance;
+		}
+
+		//清空缓存并使用新的配置，只能在使用缓存之前调用
+		void configure(const result_cache_config& config) {
+			config_ = config;
+			config_.shard_count = config_.shard_count == 0 ? 1 : config_.shard_count;
+			shards_ = std::make_unique<shard[]>(config_.shard_count);
+			shard_count_ = config_.shard_count;
+		}
+
+		//查询前取版本号，和结果一起放进缓存
+		uint64_t version(std::string_view table) const {
+			return table_versions_[slot(table)] + epoch_;
+		}
+
+		template<typename T>
+		std::shared_ptr<const std::vector<T>> get(const std::string& key, std::string_view table) {
+			shard& s = shard_of(key);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			auto it = s.map.find(key);
+			if (it == s.map.end()) {
+				misses_++;
+				return nullptr;
+			}
+
+			entry& e = *it->second;
+			if (e.expires < clock::now() || e.version != version(table)) {
+				s.erase(it->second);
+				misses_++;
+				return nullptr;
+			}
+
+			hits_++;
+			s.lru.splice(s.lru.begin(), s.lru, it->second);
+			return std::static_pointer_cast<const std::vector<T>>(e.rows);
+		}
+
+		//version是查询前取的版本号，查询期间表被修改过的结果不会命中
+		template<typename T>
+		void put(const std::string& key, uint64_t version, std::vector<T> rows) {
+			size_t bytes = key.size() + estimate_rows_bytes(rows);
+			size_t limit = config_.max_bytes / shard_count_;
+			if (bytes > limit) {
+				return;
+			}
+
+			auto value = std::make_shared<const std::vector<T>>(std::move(rows));
+			shard& s = shard_of(key);
+			std::lock_guard<std::mutex> lock(s.mtx);
+			auto it = s.map.find(key);
+			if (it != s.map.end()) {
+				s.erase(it->second);
+			}
+
+			while (!s.lru.empty() && s.bytes + bytes > limit) {
+				s.erase(std::prev(s.lru.end()));
+				evictions_++;
+			}
+
+			s.lru.push_front(entry{ key, std::move(value), bytes, clock::now() + config_.ttl, version });
+			s.map.emplace(s.lru.front().key, s.lru.begin());
+			s.bytes += bytes;
+		}
+
+		//写操作调用，表名为T::TABLE_NAME()
+		void invalidate(std::string_view table) {
+			table_versions_[slot(table)]++;
+		}
+
+		//execute等无法确定表名的写操作调用
+		void invalidate_all() {
+			epoch_++;
+		}
+
+		void clear() {
+			for (size_t i = 0; i < shard_count_; i++) {
+				std::lock_guard<std::mutex> lock(shards_[i].mtx);
+				shards_[i].lru.clear();
+				shards_[i].map.clear();
+				shards_[i].bytes = 0;
+			}
+		}
+
+		size_t hits() const { return hits_; }
+		size_t misses() const { return misses_; }
+		size_t evictions() const { return evictions_; }
+
+		double hit_rate() const {
+			size_t total = hits_ + misses_;
+			return total == 0 ? 0.0 : (double)hits_ / total;
+		}
+
+		size_t size_bytes() const {
+			size_t bytes = 0;
+			for (size_t i = 0; i < shard_count_; i++) {
+				std::lock_guard<std::mutex> lock(shards_[i].mtx);
+				bytes += shards_[i].bytes;
+			}
+			return bytes;
+		}
+
+	private:
+		result_cache() { configure(result_cache_config{}); }
+		result_cache(const result_cache&) = delete;
+		result_cache& operator=(const result_cache&) = delete;
+
+		struct entry {
+			std::string key;
+			std::shared_ptr<const void> rows;
+			size_t bytes;
+			clock::time_point expires;
+			uint64_t version;
+		};
+
+		//每个分片独占一条缓存行，避免伪共享
+		struct alignas(64) shard {
+			using iterator = std::list<entry>::iterator;
+
+			void erase(iterator it) {
+				bytes -= it->bytes;
+				map.erase(it->key);
+				lru.erase(it);
+			}
+
+			mutable std::mutex mtx;
+			std::list<entry> lru;
+			std::unordered_map<std::string_view, iterator> map; //键指向lru中的字符串
+			size_t bytes{ 0 };
+		};
+
+		shard& shard_of(const std::string& key) {
+			return shards_[std::hash<std::string>{}(key) % shard_count_];
+		}
+
+		static size_t slot(std::string_view table) {
+			return std::hash<std::string_view>{}(table) % table_slots;
+		}
+
+		//结果数组本身加上字符串等字段在堆上的部分
+		template<typename T>
+		static size_t estimate_rows_bytes(const std::vector<T>& rows) {
+			size_t bytes = sizeof(T) * rows.capacity();
+			for (auto& row : rows) {
+				for_each_value(row, [&](auto&& value) {
+					using U = std::remove_const_t<std::remove_reference_t<decltype(value)>>;
+					if constexpr (std::is_same_v<std::string, U> or std::is_same_v<blob, U>) {
+						bytes += value.capacity();
+					}
+					else if constexpr (is_optional_v<U>) {
+						using V = typename U::value_type;
+						if constexpr (std::is_same_v<std::string, V> or std::is_same_v<blob, V>) {
+							bytes += value.has_value() ? value->capacity() : 0;
+						}
+					}
+				});
+			}
+			return bytes;
+		}
+
+		static constexpr size_t table_slots = 256;
+
+		result_cache_config config_;
+		std::unique_ptr<shard[]> shards_;
+		size_t shard_count_{ 1 };
+		std::array<std::atomic<uint64_t>, table_slots> table_versions_{};
+		std::atomic<uint64_t> epoch_{ 0 };
+		std::atomic<size_t> hits_{ 0 };
+		std::atomic<size_t> misses_{ 0 };
+		std::atomic<size_t> evictions_{ 0 };
+	};
+
+	/*
+	* 把绑定参数按类型和二进制值追加到缓存键中
+	* 数值类型的MYSQL_BIND没有填buffer_length，按类型取长度
+	*/
+	inline void append_param_key(std::string& key, const MYSQL_BIND* binds, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			const MYSQL_BIND& bind = binds[i];
+			size_t len = 0;
+			switch (bind.buffer_type) {
+			case MYSQL_TYPE_NULL: len = 0; break;
+			case MYSQL_TYPE_TINY: len = 1; break;
+			case MYSQL_TYPE_SHORT: len = 2; break;
+			case MYSQL_TYPE_LONG: len = 4; break;
+			case MYSQL_TYPE_FLOAT: len = 4; break;
+			case MYSQL_TYPE_LONGLONG: len = 8; break;
+			case MYSQL_TYPE_DOUBLE: len = 8; break;
+			default: len = bind.buffer_length; break;
+			}
+
+			key += '\0';
+			key += (char)bind.buffer_type;
+			key += bind.is_unsigned ? 'u' : 's';
+			key.append((const char*)&len, sizeof(len));
+			if (len > 0) {
+				key.append((const char*)bind.buffer, len);
+			}
+		}
+	}
+}
+
+#endif //RESULT_CACHE_H
@@ -0,0 +1,228 @@
+#ifndef RESULT_SET_H
+#define RESULT_SET_H
+
+#include<span>
+#include<vector>
+#include<string>
+#include<string_view>
+#include<optional>
+#include<iterator>
+#include<string.h>
+
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	//结果集中字段的访问类型：数值按值，字符串为string_view，blob为span，optional套在外面
+	template<typename U, typename = void>
+	struct view_of {
+		static_assert(std::is_arithmetic_v<U>, "type is not supported by result_set");
+		using type = U;
+	};
+
+	template<typename U>
+	struct view_of<U, std::enable_if_t<std::is_same_v<std::string, U> ||
+		is_char_array_v<U> || is_char_std_array_v<U>>> {
+		using type = std::string_view;
+	};
+
+	template<>
+	struct view_of<blob> {
+		using type = std::span<const char>;
+	};
+
+	template<typename U>
+	struct view_of<std::optional<U>> {
+		using type = std::optional<typename view_of<U>::type>;
+	};
+
+	template<typename U>
+	using view_of_t = typename view_of<U>::type;
+
+	/*
+	* 不拷贝成对象的查询结果，所有行的字符串和blob放在同一块arena里
+	* 每行每列一个cell，数值直接存在cell里，变长数据存在arena中的偏移和长度
+	* 行只是(结果集, 行号)，字段按view_of_t访问，结果集销毁后视图全部失效
+	* 需要独立的对象时调用materialize()
+	*
+	* auto rs = db.query_result<Person>("where age > 18");
+	* for (auto row : rs) {
+	*     std::string_view name = row.get<1>();
+	* }
+	*/
+	template<typename T>
+	class result_set {
+		static_assert(is_reflection_v<T>);
+
+		struct cell {
+			uint64_t value; //数值，或者变长数据在arena中的偏移
+			uint32_t size;
+			bool null;
+		};
+
+	public:
+		static constexpr size_t size_v = T::field_count;
+
+		class row {
+		public:
+			row(const result_set* set, size_t index) :set_(set), index_(index) {}
+
+			//第I个字段，I和DEFINE_TABLE中字段的顺序一致
+			template<size_t I>
+			view_of_t<field_type_t<T, I>> get() const {
+				return set_->template view<field_type_t<T, I>>(set_->at(index_, I));
+			}
+
+			bool is_null(size_t i) const { return set_->at(index_, i).null; }
+
+			//拷贝成独立的对象
+			T materialize() const {
+				T t{};
+				size_t i = 0;
+				forEach(t, [&](auto&& fieldName, auto&& value) {
+					set_->assign(set_->at(index_, i), value);
+					i++;
+				});
+				return t;
+			}
+
+		private:
+			const result_set* set_;
+			size_t index_;
+		};
+
+		struct iterator {
+			using iterator_category = std::input_iterator_tag;
+			using value_type = row;
+			using difference_type = std::ptrdiff_t;
+			using pointer = void;
+			using reference = row;
+
+			row operator*() const { return row(set_, index_); }
+			iterator& operator++() {
+				index_++;
+				return *this;
+			}
+			iterator operator++(int) {
+				iterator it = *this;
+				index_++;
+				return it;
+			}
+			bool operator==(const iterator& other) const { return index_ == other.index_; }
+			bool operator!=(const iterator& other) const { return index_ != other.index_; }
+
+			const result_set* set_;
+			size_t index_;
+		};
+
+		size_t size() const { return cells_.size() / size_v; }
+		bool empty() const { return cells_.empty(); }
+		row operator[](size_t i) const { return row(this, i); }
+		iterator begin() const { return iterator{ this, 0 }; }
+		iterator end() const { return iterator{ this, size() }; }
+
+		//arena中变长数据的总字节数
+		size_t arena_size() const { return arena_.size(); }
+
+		std::vector<T> materialize() const {
+			std::vector<T> v;
+			v.reserve(size());
+			for (size_t i = 0; i < size(); i++) {
+				v.push_back(row(this, i).materialize());
+			}
+			return v;
+		}
+
+		void reserve(size_t rows) { cells_.reserve(rows * size_v); }
+
+		void clear() {
+			cells_.clear();
+			arena_.clear();
+		}
+
+		//追加binder当前行的所有列
+		template<typename Binder>
+		void append(const Binder& binder) {
+			append(binder, std::make_index_sequence<size_v>{});
+		}
+
+	private:
+		template<typename Binder, size_t... Is>
+		void append(const Binder& binder, std::index_sequence<Is...>) {
+			(append_cell<field_type_t<T, Is>>(binder, Is), ...);
+		}
+
+		template<typename U, typename Binder>
+		void append_cell(const Binder& binder, size_t i) {
+			if constexpr (is_optional_v<U>) {
+				append_cell<typename U::value_type>(binder, i);
+			}
+			else {
+				cell c{ 0, 0, binder.is_null(i) };
+				if constexpr (std::is_arithmetic_v<U>) {
+					U value = binder.template scalar<U>(i);
+					memcpy(&c.value, &value, sizeof(U));
+				}
+				else {
+					std::string_view data = binder.column(i);
+					c.value = arena_.size();
+					c.size = (uint32_t)data.size();
+					arena_.insert(arena_.end(), data.begin(), data.end());
+				}
+				cells_.push_back(c);
+			}
+		}
+
+		const cell& at(size_t row, size_t column) const { return cells_[row * size_v + column]; }
+
+		template<typename U>
+		view_of_t<U> view(const cell& c) const {
+			if constexpr (is_optional_v<U>) {
+				if (c.null) {
+					return std::nullopt;
+				}
+				return view<typename U::value_type>(c);
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				U value;
+				memcpy(&value, &c.value, sizeof(U));
+				return value;
+			}
+			else {
+				return view_of_t<U>(arena_.data() + c.value, c.size);
+			}
+		}
+
+		template<typename U>
+		void assign(const cell& c, U& value) const {
+			if constexpr (is_optional_v<U>) {
+				if (c.null) {
+					value.reset();
+				}
+				else {
+					assign(c, value.emplace());
+				}
+			}
+			else if constexpr (std::is_arithmetic_v<U>) {
+				value = view<U>(c);
+			}
+			else if constexpr (std::is_same_v<std::string, U>) {
+				value.assign(arena_.data() + c.value, c.size);
+			}
+			else if constexpr (std::is_same_v<blob, U>) {
+				value.assign(arena_.data() + c.value, arena_.data() + c.value + c.size);
+			}
+			else { //定长数组，剩余部分补0
+				char* dst = (char*)&value;
+				memcpy(dst, arena_.data() + c.value, c.size);
+				memset(dst + c.size, 0, sizeof(U) - c.size);
+			}
+		}
+
+		std::vector<cell> cells_;
+		std::vector<char> arena_;
+	};
+}
+
+#endif //RESULT_SET_H
@@ -0,0 +1,232 @@
+#ifndef ROUTING_POOL_H
+#define ROUTING_POOL_H
+
+#include<memory>
+#include<vector>
+#include<atomic>
+#include<chrono>
+#include<utility>
+
+#include"connection_pool.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 读写分离的配置
+	* read_your_writes : 本线程写过主库之后这段时间内的读也走主库，避免读不到刚写的数据，0表示不启用
+	*/
+	struct routing_config {
+		std::chrono::milliseconds read_your_writes{ 0 };
+	};
+
+	template<typename DB>
+	class routing_pool;
+
+	/*
+	* 从routing_pool借出的连接，离开作用域时归还到原来的节点
+	* 读连接归还时减少节点上进行中的请求数，写连接归还时记录本线程最后一次写的时间
+	*/
+	template<typename DB>
+	class routed_lease {
+	public:
+		routed_lease() = default;
+		routed_lease(std::nullptr_t) {}
+
+		routed_lease(routed_lease&& other) noexcept
+			:lease_(std::move(other.lease_)), outstanding_(other.outstanding_), writer_(other.writer_) {
+			other.outstanding_ = nullptr;
+			other.writer_ = nullptr;
+		}
+
+		routed_lease& operator=(routed_lease&& other) noexcept {
+			if (this != &other) {
+				reset();
+				lease_ = std::move(other.lease_);
+				outstanding_ = other.outstanding_;
+				writer_ = other.writer_;
+				other.outstanding_ = nullptr;
+				other.writer_ = nullptr;
+			}
+			return *this;
+		}
+
+		routed_lease(const routed_lease&) = delete;
+		routed_lease& operator=(const routed_lease&) = delete;
+
+		~routed_lease() { reset(); }
+
+		//提前归还
+		void reset() {
+			lease_.reset();
+			if (outstanding_ != nullptr) {
+				(*outstanding_)--;
+				outstanding_ = nullptr;
+			}
+			if (writer_ != nullptr) {
+				writer_->mark_write();
+				writer_ = nullptr;
+			}
+		}
+
+		DB* get() const { return lease_.get(); }
+		DB* operator->() const { return lease_.get(); }
+		DB& operator*() const { return *lease_; }
+		explicit operator bool() const { return static_cast<bool>(lease_); }
+		bool operator==(std::nullptr_t) const { return lease_ == nullptr; }
+
+	private:
+		friend class routing_pool<DB>;
+
+		routed_lease(connection_lease<DB> lease, std::atomic<long>* outstanding, routing_pool<DB>* writer)
+			:lease_(std::move(lease)), outstanding_(outstanding), writer_(writer) {}
+
+		connection_lease<DB> lease_;
+		std::atomic<long>* outstanding_{ nullptr }; //读连接所在节点的请求计数
+		routing_pool<DB>* writer_{ nullptr }; //写连接才有
+	};
+
+	/*
+	* 一个主库加多个从库，每个节点一个connection_pool
+	* 写和事务用write()走主库，读用read()走进行中请求最少的从库
+	* 没有从库、从库都取不到连接或者在read_your_writes窗口内时，读也走主库
+	* 节点在使用之前添加，之后不能再修改
+	*
+	* manjusaka::routing_pool<mysql> router;
+	* router.init_primary(config, "127.0.0.1", "root", "pwd", "test", 3, 3306);
+	* router.add_replica(config, "127.0.0.1", "root", "pwd", "test", 3, 3307);
+	* router.write()->insert(p);
+	* auto v = router.query<Person>("where age > 18");
+	*/
+	template<typename DB>
+	class routing_pool {
+	public:
+		using lease = routed_lease<DB>;
+		using clock = std::chrono::steady_clock;
+
+		routing_pool() = default;
+		explicit routing_pool(const routing_config& config) :config_(config) {}
+
+		routing_pool(const routing_pool&) = delete;
+		routing_pool& operator=(const routing_pool&) = delete;
+
+		//参数和connection_pool::init相同
+		template<typename... Args>
+		void init_primary(const pool_config& config, Args &&...args) {
+			primary_.pool.init(config, std::forward<Args>(args)...);
+		}
+
+		template<typename... Args>
+		void add_replica(const pool_config& config, Args &&...args) {
+			auto n = std::make_unique<node>();
+			n->pool.init(config, std::forward<Args>(args)...);
+			replicas_.push_back(std::move(n));
+		}
+
+		//主库连接，用于写和事务
+		lease write() {
+			connection_lease<DB> l = primary_.pool.get();
+			if (!l) {
+				return nullptr;
+			}
+			return lease(std::move(l), nullptr, this);
+		}
+
+		/*
+		* 读连接，选进行中请求最少的从库，相同时从上次的下一个开始轮转
+		* 选中的从库等待超时(通常是节点不可用)后，不等待地试其他从库，最后退回主库
+		*/
+		lease read() {
+			if (replicas_.empty() || recently_written()) {
+				return read_from(primary_, primary_.pool.wait_timeout());
+			}
+
+			size_t count = replicas_.size();
+			size_t start = next_++ % count;
+			size_t best = start;
+			for (size_t i = 1; i < count; i++) {
+				size_t index = (start + i) % count;
+				if (replicas_[index]->outstanding < replicas_[best]->outstanding) {
+					best = index;
+				}
+			}
+
+			node& n = *replicas_[best];
+			lease l = read_from(n, n.pool.wait_timeout());
+			for (size_t i = 1; i < count && !l; i++) {
+				l = read_from(*replicas_[(best + i) % count], std::chrono::milliseconds(0));
+			}
+			return l ? std::move(l) : read_from(primary_, primary_.pool.wait_timeout());
+		}
+
+		//在读连接上执行mysql::query，取不到连接时返回空数组
+		template<typename T, typename... Args>
+		auto query(Args &&...args) -> decltype(std::declval<DB&>().template query<T>(std::forward<Args>(args)...)) {
+			lease l = read();
+			if (!l) {
+				return {};
+			}
+			return l->template query<T>(std::forward<Args>(args)...);
+		}
+
+		//写连接以外的写操作(例如在读连接上执行的存储过程)可以手动标记
+		void mark_write() {
+			if (config_.read_your_writes.count() > 0) {
+				last_write& w = this_thread_write();
+				w.owner = this;
+				w.time = clock::now();
+			}
+		}
+
+		connection_pool<DB>& primary() { return primary_.pool; }
+		connection_pool<DB>& replica(size_t index) { return replicas_[index]->pool; }
+		size_t replica_count() const { return replicas_.size(); }
+
+		//从库上进行中的请求数
+		size_t outstanding(size_t index) const {
+			long n = replicas_[index]->outstanding;
+			return n > 0 ? (size_t)n : 0;
+		}
+
+	private:
+		struct node {
+			connection_pool<DB> pool;
+			std::atomic<long> outstanding{ 0 };
+		};
+
+		//每个线程只记录最近一次写的是哪个routing_pool
+		struct last_write {
+			const routing_pool* owner{ nullptr };
+			clock::time_point time;
+		};
+
+		static last_write& this_thread_write() {
+			static thread_local last_write w;
+			return w;
+		}
+
+		bool recently_written() const {
+			if (config_.read_your_writes.count() <= 0) {
+				return false;
+			}
+			const last_write& w = this_thread_write();
+			return w.owner == this && clock::now() - w.time < config_.read_your_writes;
+		}
+
+		lease read_from(node& n, std::chrono::milliseconds timeout) {
+			n.outstanding++;
+			connection_lease<DB> l = n.pool.get(timeout);
+			if (!l) {
+				n.outstanding--;
+				return nullptr;
+			}
+			return lease(std::move(l), &n.outstanding, nullptr);
+		}
+
+		routing_config config_;
+		node primary_;
+		std::vector<std::unique_ptr<node>> replicas_;
+		std::atomic<size_t> next_{ 0 };
+	};
+}
+
+#endif //ROUTING_POOL_H
@@ -0,0 +1,523 @@
+#ifndef STATEMENT_STATS_H
+#define STATEMENT_STATS_H
+
+#include<map>
+#include<mutex>
+#include<atomic>
+#include<memory>
+#include<string>
+#include<string_view>
+#include<vector>
+#include<array>
+#include<chrono>
+#include<algorithm>
+#include<bit>
+#include<unordered_map>
+#include<stdio.h>
+#include<ctype.h>
+#include<stdint.h>
+
+namespace manjusaka {
+
+	/*
+	* 语句级别的耗时统计，编译时定义ORMCPP_DISABLE_STATS后statement_probe的函数都是空的，
+	* mysql中的统计代码全部被优化掉；statement_stats仍然存在，快照为空
+	*/
+#ifdef ORMCPP_DISABLE_STATS
+	inline constexpr bool statement_stats_enabled = false;
+#else
+	inline constexpr bool statement_stats_enabled = true;
+#endif
+
+	//一条语句的几个阶段，不缓冲的查询边读边转换，读取和转换都记在fetch
+	enum class statement_phase : size_t { prepare, execute, fetch, materialize };
+
+	inline constexpr size_t statement_phase_count = 4;
+
+	inline const char* phase_name(size_t phase) {
+		static const char* names[statement_phase_count] = { "prepare", "execute", "fetch", "materialize" };
+		return names[phase];
+	}
+
+	/*
+	* 对数线性分桶的延迟直方图，单位纳秒，思路和HdrHistogram相同
+	* 16纳秒以下每纳秒一个桶，之后每个2的幂区间平均分成16个桶，相对误差不超过1/16
+	* 超过2^36纳秒(约69秒)的都记在最后一个桶
+	*/
+	class latency_histogram {
+	public:
+		static constexpr size_t sub_bits = 4;
+		static constexpr size_t sub_count = size_t(1) << sub_bits;
+		static constexpr size_t max_exponent = 36;
+		static constexpr size_t bucket_count = (max_exponent - sub_bits + 1) * sub_count;
+
+		void record(uint64_t ns) {
+			counts_[bucket_of(ns)]++;
+			min_ = count_ == 0 ? ns : (std::min)(min_, ns);
+			max_ = (std::max)(max_, ns);
+			count_++;
+			sum_ += ns;
+		}
+
+		void merge(const latency_histogram& other) {
+			if (other.count_ == 0) {
+				return;
+			}
+			for (size_t i = 0; i < bucket_count; i++) {
+				counts_[i] += other.counts_[i];
+			}
+			min_ = count_ == 0 ? other.min_ : (std::min)(min_, other.min_);
+			max_ = (std::max)(max_, other.max_);
+			count_ += other.count_;
+			sum_ += other.sum_;
+		}
+
+		uint64_t count() const { return count_; }
+		uint64_t sum() const { return sum_; }
+		uint64_t min() const { return min_; }
+		uint64_t max() const { return max_; }
+		double mean() const { return count_ == 0 ? 0 : (double)sum_ / count_; }
+
+		//q在[0, 1]之间，返回所在桶的上界，不超过实际的最大值
+		uint64_t percentile(double q) const {
+			if (count_ == 0) {
+				return 0;
+			}
+
+			uint64_t rank = (uint64_t)(q * count_ + 0.999999);
+			rank = (std::max)(rank, (uint64_t)1);
+			uint64_t seen = 0;
+			for (size_t i = 0; i < bucket_count; i++) {
+				seen += counts_[i];
+				if (seen >= rank) {
+					return (std::max)(min_, (std::min)(max_, lower_bound(i) + width(i) - 1));
+				}
+			}
+			return max_;
+		}
+
+		static size_t bucket_of(uint64_t ns) {
+			if (ns < sub_count) {
+				return (size_t)ns;
+			}
+
+			size_t exponent = (size_t)std::bit_width(ns) - 1;
+			if (exponent >= max_exponent) {
+				return bucket_count - 1;
+			}
+			return (exponent - sub_bits + 1) * sub_count + (size_t)(ns >> (exponent - sub_bits)) - sub_count;
+		}
+
+		static uint64_t lower_bound(size_t bucket) {
+			if (bucket < sub_count) {
+				return bucket;
+			}
+			size_t group = bucket / sub_count;
+			return (uint64_t)(sub_count + bucket % sub_count) << (group - 1);
+		}
+
+		static uint64_t width(size_t bucket) {
+			return bucket < sub_count ? 1 : uint64_t(1) << (bucket / sub_count - 1);
+		}
+
+	private:
+		std::array<uint64_t, bucket_count> counts_ = {};
+		uint64_t count_{ 0 };
+		uint64_t sum_{ 0 };
+		uint64_t min_{ 0 };
+		uint64_t max_{ 0 };
+	};
+
+	//同一种sql的累计数据
+	struct statement_record {
+		std::array<latency_histogram, statement_phase_count> phases;
+		uint64_t executions{ 0 };
+		uint64_t rows{ 0 }; //查询返回的行数或者写操作影响的行数
+		uint64_t bytes_sent{ 0 }; //绑定参数的估算大小
+		uint64_t bytes_received{ 0 }; //结果中各列数据的长度之和
+		std::map<unsigned int, uint64_t> errors; //错误码和次数，0表示发送前客户端的检查失败
+
+		void merge(const statement_record& other) {
+			for (size_t i = 0; i < statement_phase_count; i++) {
+				phases[i].merge(other.phases[i]);
+			}
+			executions += other.executions;
+			rows += other.rows;
+			bytes_sent += other.bytes_sent;
+			bytes_received += other.bytes_received;
+			for (auto& [code, count] : other.errors) {
+				errors[code] += count;
+			}
+		}
+
+		uint64_t error_count() const {
+			uint64_t n = 0;
+			for (auto& [code, count] : errors) {
+				n += count;
+			}
+			return n;
+		}
+
+		uint64_t total_ns() const {
+			uint64_t ns = 0;
+			for (auto& h : phases) {
+				ns += h.sum();
+			}
+			return ns;
+		}
+	};
+
+	struct statement_summary {
+		std::string sql;
+		statement_record stats;
+	};
+
+	//一次执行的测量结果，由statement_probe填写
+	struct statement_sample {
+		std::array<uint64_t, statement_phase_count> ns = {};
+		unsigned int phase_mask{ 0 };
+		uint64_t rows{ 0 };
+		uint64_t bytes_sent{ 0 };
+		uint64_t bytes_received{ 0 };
+		bool failed{ false };
+		unsigned int error_code{ 0 };
+	};
+
+	/*
+	* 把sql归一成语句的形状：字符串和数字常量换成?，连续的空白合并成一个空格
+	* 超过max_length的部分截掉，行数不同的多行insert会归到同一种
+	*/
+	inline void normalize_sql(std::string_view sql, std::string& out, size_t max_length = 256) {
+		out.clear();
+		size_t i = 0;
+		while (i < sql.size() && out.size() < max_length) {
+			char c = sql[i];
+			if (c == '\'' || c == '"') {
+				i++;
+				while (i < sql.size() && sql[i] != c) {
+					i += sql[i] == '\\' ? 2 : 1;
+				}
+				i++;
+				out += '?';
+			}
+			else if (isdigit((unsigned char)c) && (out.empty() ||
+				!(isalnum((unsigned char)out.back()) || out.back() == '_'))) {
+				while (i < sql.size() && (isalnum((unsigned char)sql[i]) || sql[i] == '.')) {
+					i++;
+				}
+				out += '?';
+			}
+			else if (isspace((unsigned char)c)) {
+				while (i < sql.size() && isspace((unsigned char)sql[i])) {
+					i++;
+				}
+				if (!out.empty()) {
+					out += ' ';
+				}
+			}
+			else {
+				out += c;
+				i++;
+			}
+		}
+
+		if (i < sql.size()) {
+			out += "...";
+		}
+		else if (!out.empty() && out.back() == ' ') {
+			out.pop_back();
+		}
+	}
+
+	/*
+	* 进程内所有mysql连接的语句统计
+	* 每个线程写自己的缓冲区，只和取快照的线程竞争缓冲区的锁
+	* 线程结束时它的数据合并到retired_，不会丢失
+	*
+	* auto& stats = manjusaka::statement_stats::instance();
+	* std::cout << stats.dump_text();
+	* for (auto& s : stats.snapshot()) { s.sql; s.stats.phases[...].percentile(0.99); }
+	*/
+	class statement_stats {
+		using shape_map = std::unordered_map<std::string, statement_record>;
+
+		struct thread_buffer {
+			std::mutex mtx;
+			shape_map shapes;
+			std::string scratch; //归一化sql的缓冲区，避免每次分配
+		};
+
+	public:
+		static statement_stats& instance() {
+			static statement_stats instance;
+			return instance;
+		}
+
+		//运行时的开关，关闭后statement_probe不读时钟也不记录
+		void enable(bool enable) { enabled_.store(enable, std::memory_order_relaxed); }
+		bool enabled() const { return statement_stats_enabled && enabled_.load(std::memory_order_relaxed); }
+
+		void record(std::string_view sql, const statement_sample& sample) {
+			thread_buffer& buffer = local();
+			std::lock_guard<std::mutex> lock(buffer.mtx);
+			normalize_sql(sql, buffer.scratch);
+			auto it = buffer.shapes.find(buffer.scratch);
+			if (it == buffer.shapes.end()) {
+				it = buffer.shapes.emplace(buffer.scratch, statement_record{}).first;
+			}
+
+			statement_record& record = it->second;
+			record.executions++;
+			for (size_t i = 0; i < statement_phase_count; i++) {
+				if (sample.phase_mask & (1u << i)) {
+					record.phases[i].record(sample.ns[i]);
+				}
+			}
+			record.rows += sample.rows;
+			record.bytes_sent += sample.bytes_sent;
+			record.bytes_received += sample.bytes_received;
+			if (sample.failed) {
+				record.errors[sample.error_code]++;
+			}
+		}
+
+		//合并所有线程的数据，按总耗时从大到小排序
+		std::vector<statement_summary> snapshot() const {
+			shape_map merged;
+			{
+				std::lock_guard<std::mutex> lock(mtx_);
+				merged = retired_;
+				for (auto& buffer : buffers_) {
+					std::lock_guard<std::mutex> buffer_lock(buffer->mtx);
+					for (auto& [sql, record] : buffer->shapes) {
+						merged[sql].merge(record);
+					}
+				}
+			}
+
+			std::vector<statement_summary> v;
+			v.reserve(merged.size());
+			for (auto& [sql, record] : merged) {
+				v.push_back({ sql, std::move(record) });
+			}
+			std::sort(v.begin(), v.end(), [](const statement_summary& a, const statement_summary& b) {
+				return a.stats.total_ns() > b.stats.total_ns();
+			});
+			return v;
+		}
+
+		void reset() {
+			std::lock_guard<std::mutex> lock(mtx_);
+			retired_.clear();
+			for (auto& buffer : buffers_) {
+				std::lock_guard<std::mutex> buffer_lock(buffer->mtx);
+				buffer->shapes.clear();
+			}
+		}
+
+		//每种语句一段，时间单位微秒
+		std::string dump_text() const {
+			std::string s;
+			char line[256];
+			for (auto& summary : snapshot()) {
+				auto& r = summary.stats;
+				s += summary.sql;
+				s += '\n';
+				snprintf(line, sizeof(line), "  executions %llu, rows %llu, bytes sent %llu, received %llu, errors %llu",
+					(unsigned long long)r.executions, (unsigned long long)r.rows, (unsigned long long)r.bytes_sent,
+					(unsigned long long)r.bytes_received, (unsigned long long)r.error_count());
+				s += line;
+				for (auto& [code, count] : r.errors) {
+					snprintf(line, sizeof(line), " [%u: %llu]", code, (unsigned long long)count);
+					s += line;
+				}
+				s += '\n';
+
+				for (size_t i = 0; i < statement_phase_count; i++) {
+					auto& h = r.phases[i];
+					if (h.count() == 0) {
+						continue;
+					}
+					snprintf(line, sizeof(line),
+						"  %-11s count %llu, mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f us\n",
+						phase_name(i), (unsigned long long)h.count(), h.mean() / 1000, h.percentile(0.5) / 1000.0,
+						h.percentile(0.9) / 1000.0, h.percentile(0.99) / 1000.0, h.max() / 1000.0);
+					s += line;
+				}
+			}
+			return s;
+		}
+
+		//json数组，每种语句一个对象，时间单位纳秒
+		std::string dump_json() const {
+			std::string s = "[";
+			char buf[256];
+			bool first = true;
+			for (auto& summary : snapshot()) {
+				auto& r = summary.stats;
+				s += first ? "\n" : ",\n";
+				first = false;
+
+				s += "{\"sql\":";
+				append_json_string(s, summary.sql);
+				snprintf(buf, sizeof(buf), ",\"executions\":%llu,\"rows\":%llu,\"bytes_sent\":%llu,\"bytes_received\":%llu",
+					(unsigned long long)r.executions, (unsigned long long)r.rows,
+					(unsigned long long)r.bytes_sent, (unsigned long long)r.bytes_received);
+				s += buf;
+
+				s += ",\"errors\":{";
+				bool first_error = true;
+				for (auto& [code, count] : r.errors) {
+					snprintf(buf, sizeof(buf), "%s\"%u\":%llu", first_error ? "" : ",", code, (unsigned long long)count);
+					s += buf;
+					first_error = false;
+				}
+
+				s += "},\"phases\":{";
+				bool first_phase = true;
+				for (size_t i = 0; i < statement_phase_count; i++) {
+					auto& h = r.phases[i];
+					if (h.count() == 0) {
+						continue;
+					}
+					snprintf(buf, sizeof(buf), "%s\"%s\":{\"count\":%llu,\"mean_ns\":%.1f,\"p50_ns\":%llu,"
+						"\"p90_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}",
+						first_phase ? "" : ",", phase_name(i), (unsigned long long)h.count(), h.mean(),
+						(unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.9),
+						(unsigned long long)h.percentile(0.99), (unsigned long long)h.max());
+					s += buf;
+					first_phase = false;
+				}
+				s += "}}";
+			}
+			s += first ? "]" : "\n]";
+			return s;
+		}
+
+	private:
+		//线程第一次记录时注册缓冲区，线程结束时合并后注销
+		struct thread_holder {
+			std::shared_ptr<thread_buffer> buffer;
+
+			~thread_holder() {
+				if (buffer) {
+					statement_stats::instance().retire(buffer);
+				}
+			}
+		};
+
+		thread_buffer& local() {
+			static thread_local thread_holder holder;
+			if (!holder.buffer) {
+				holder.buffer = std::make_shared<thread_buffer>();
+				std::lock_guard<std::mutex> lock(mtx_);
+				buffers_.push_back(holder.buffer);
+			}
+			return *holder.buffer;
+		}
+
+		void retire(const std::shared_ptr<thread_buffer>& buffer) {
+			std::lock_guard<std::mutex> lock(mtx_);
+			{
+				std::lock_guard<std::mutex> buffer_lock(buffer->mtx);
+				for (auto& [sql, record] : buffer->shapes) {
+					retired_[sql].merge(record);
+				}
+			}
+			buffers_.erase(std::remove(buffers_.begin(), buffers_.end(), buffer), buffers_.end());
+		}
+
+		static void append_json_string(std::string& s, std::string_view text) {
+			s += '"';
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					s += '\\';
+					s += c;
+				}
+				else if ((unsigned char)c < 0x20) {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+					s += buf;
+				}
+				else {
+					s += c;
+				}
+			}
+			s += '"';
+		}
+
+		std::atomic<bool> enabled_{ true };
+		mutable std::mutex mtx_;
+		std::vector<std::shared_ptr<thread_buffer>> buffers_;
+		shape_map retired_; //已经结束的线程的数据
+	};
+
+	/*
+	* 一条语句的测量，构造时开始计时，lap记录从上一次lap(或构造)到现在的时间
+	* 析构时把结果交给statement_stats，sql要比probe活得久
+	* 关闭统计时所有函数都是空的，active()为false，只为统计做的计算可以放在if (probe.active())里
+	*/
+#ifdef ORMCPP_DISABLE_STATS
+	class statement_probe {
+	public:
+		explicit statement_probe(std::string_view sql) {}
+		void lap(statement_phase phase) {}
+		void rows(uint64_t n) {}
+		void bytes_sent(uint64_t n) {}
+		void bytes_received(uint64_t n) {}
+		void error(unsigned int code) {}
+		constexpr bool active() const { return false; }
+	};
+#else
+	class statement_probe {
+		using clock = std::chrono::steady_clock;
+
+	public:
+		explicit statement_probe(std::string_view sql)
+			:sql_(sql), active_(statement_stats::instance().enabled()) {
+			if (active_) {
+				last_ = clock::now();
+			}
+		}
+
+		~statement_probe() {
+			if (active_) {
+				statement_stats::instance().record(sql_, sample_);
+			}
+		}
+
+		statement_probe(const statement_probe&) = delete;
+		statement_probe& operator=(const statement_probe&) = delete;
+
+		void lap(statement_phase phase) {
+			if (!active_) {
+				return;
+			}
+			auto now = clock::now();
+			size_t i = (size_t)phase;
+			sample_.ns[i] += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+			sample_.phase_mask |= 1u << i;
+			last_ = now;
+		}
+
+		void rows(uint64_t n) { sample_.rows += n; }
+		void bytes_sent(uint64_t n) { sample_.bytes_sent += n; }
+		void bytes_received(uint64_t n) { sample_.bytes_received += n; }
+
+		void error(unsigned int code) {
+			sample_.failed = true;
+			sample_.error_code = code;
+		}
+
+		bool active() const { return active_; }
+
+	private:
+		std::string_view sql_;
+		bool active_;
+		clock::time_point last_;
+		statement_sample sample_;
+	};
+#endif
+}
+
+#endif //STATEMENT_STATS_H
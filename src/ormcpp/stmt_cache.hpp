@@ -0,0 +1,109 @@
+#ifndef STMT_CACHE_H
+#define STMT_CACHE_H
+
+#include<list>
+#include<string>
+#include<string_view>
+#include<unordered_map>
+#include<mysql/mysql.h>
+
+namespace manjusaka {
+
+	/*
+	* 以sql文本为键缓存预处理语句句柄的LRU
+	* 每个连接持有一份，和连接一样不是线程安全的
+	* 被淘汰或删除的句柄会直接mysql_stmt_close
+	*/
+	class stmt_cache {
+	public:
+		explicit stmt_cache(size_t capacity = 64) : capacity_(capacity == 0 ? 1 : capacity) {}
+		~stmt_cache() { clear(); }
+
+		stmt_cache(const stmt_cache&) = delete;
+		stmt_cache& operator=(const stmt_cache&) = delete;
+
+		//命中时移到表头，未命中返回nullptr
+		MYSQL_STMT* get(std::string_view sql) {
+			auto it = map_.find(sql);
+			if (it == map_.end()) {
+				misses_++;
+				return nullptr;
+			}
+
+			hits_++;
+			lru_.splice(lru_.begin(), lru_, it->second);
+			return it->second->second;
+		}
+
+		void put(std::string_view sql, MYSQL_STMT* stmt) {
+			erase(sql);
+			while (lru_.size() >= capacity_) {
+				evict(std::prev(lru_.end()));
+				evictions_++;
+			}
+
+			lru_.emplace_front(sql, stmt);
+			map_.emplace(lru_.front().first, lru_.begin());
+		}
+
+		//取出句柄但不关闭，由调用者负责放回或关闭
+		MYSQL_STMT* take(std::string_view sql) {
+			auto it = map_.find(sql);
+			if (it == map_.end()) {
+				return nullptr;
+			}
+
+			MYSQL_STMT* stmt = it->second->second;
+			lru_.erase(it->second);
+			map_.erase(it);
+			return stmt;
+		}
+
+		void erase(std::string_view sql) {
+			auto it = map_.find(sql);
+			if (it != map_.end()) {
+				evict(it->second);
+			}
+		}
+
+		//重连之后服务端的语句全部失效，只需释放客户端的句柄
+		void clear() {
+			while (!lru_.empty()) {
+				evict(lru_.begin());
+			}
+		}
+
+		void set_capacity(size_t capacity) {
+			capacity_ = capacity == 0 ? 1 : capacity;
+			while (lru_.size() > capacity_) {
+				evict(std::prev(lru_.end()));
+				evictions_++;
+			}
+		}
+
+		size_t size() const { return lru_.size(); }
+		size_t capacity() const { return capacity_; }
+		size_t hits() const { return hits_; }
+		size_t misses() const { return misses_; }
+		size_t evictions() const { return evictions_; }
+
+	private:
+		using entry = std::pair<std::string, MYSQL_STMT*>;
+		using iterator = std::list<entry>::iterator;
+
+		void evict(iterator it) {
+			mysql_stmt_close(it->second);
+			map_.erase(it->first);
+			lru_.erase(it);
+		}
+
+		size_t capacity_;
+		size_t hits_{ 0 };
+		size_t misses_{ 0 };
+		size_t evictions_{ 0 };
+		std::list<entry> lru_;
+		std::unordered_map<std::string_view, iterator> map_; //键指向lru_中的字符串，不额外拷贝
+	};
+}
+
+#endif //STMT_CACHE_H
@@ -0,0 +1,177 @@
+#ifndef TEXT_PROTOCOL_H
+#define TEXT_PROTOCOL_H
+
+#include<string>
+#include<cstdint>
+#include<string.h>
+#include<charconv>
+#include<algorithm>
+#include<type_traits>
+#include<mysql/mysql.h>
+
+#include"operation.hpp"
+#include"reflection.hpp"
+#include"type_mapping.hpp"
+
+namespace manjusaka {
+
+	/*
+	* 文本协议下的参数和结果转换
+	* 预处理语句没有非阻塞接口，异步连接和多语句管线只能把值直接写进sql，结果也是字符串
+	*/
+
+	inline void append_sql_string(std::string& out, MYSQL* con, const char* data, size_t len) {
+		size_t pos = out.size();
+		out.resize(pos + len * 2 + 3);
+		out[pos] = '\'';
+		unsigned long n = mysql_real_escape_string_quote(con, &out[pos + 1], data, (unsigned long)len, '\'');
+		out.resize(pos + 1 + n);
+		out += '\'';
+	}
+
+	template<typename T>
+	inline void append_sql_literal(std::string& out, MYSQL* con, const T& value) {
+		using U = std::remove_const_t<std::remove_reference_t<T>>;
+		if constexpr (is_optional_v<U>) {
+			if (value.has_value()) {
+				append_sql_literal(out, con, *value);
+			}
+			else {
+				out += "NULL";
+			}
+		}
+		else if constexpr (std::is_same_v<bool, U>) {
+			out += value ? '1' : '0';
+		}
+		else if constexpr (std::is_arithmetic_v<U>) {
+			char buf[32];
+			std::to_chars_result r;
+			if constexpr (std::is_floating_point_v<U>) {
+				r = std::to_chars(buf, buf + sizeof(buf), value);
+			}
+			else if constexpr (std::is_signed_v<U>) {
+				r = std::to_chars(buf, buf + sizeof(buf), (long long)value);
+			}
+			else {
+				r = std::to_chars(buf, buf + sizeof(buf), (unsigned long long)value);
+			}
+			out.append(buf, r.ptr);
+		}
+		else if constexpr (std::is_same_v<blob, U>) { //二进制数据用十六进制字面量，不受连接字符集影响
+			static constexpr char hex[] = "0123456789ABCDEF";
+			out += "X'";
+			for (char c : value) {
+				out += hex[(unsigned char)c >> 4];
+				out += hex[(unsigned char)c & 0xF];
+			}
+			out += '\'';
+		}
+		else if constexpr (std::is_same_v<std::string, U> or std::is_same_v<std::string_view, U>) {
+			append_sql_string(out, con, value.data(), value.size());
+		}
+		else if constexpr (is_char_std_array_v<U>) {
+			append_sql_string(out, con, value.data(), strnlen(value.data(), value.size()));
+		}
+		else if constexpr (is_char_array_v<U>) {
+			append_sql_string(out, con, value, strnlen(value, sizeof(U)));
+		}
+		else if constexpr (std::is_same_v<const char*, U>) {
+			append_sql_string(out, con, value, strlen(value));
+		}
+		else {
+			static_assert(sizeof(U) == 0, "type is not supported as a sql literal");
+		}
+	}
+
+	//(v1, v2, v3)
+	template<typename T>
+	inline void append_sql_row(std::string& out, MYSQL* con, const T& t) {
+		out += '(';
+		bool first = true;
+		for_each_value(t, [&](auto&& value) {
+			if (!first) {
+				out += ", ";
+			}
+			first = false;
+			append_sql_literal(out, con, value);
+		});
+		out += ')';
+	}
+
+	/*
+	* insert into Person(id, name, age) values(1, 'JOJO', 15),(...);
+	* 从first开始最多拼max_rows行，超过max_size字节后不再追加，first移到下一批的起点
+	*/
+	template<typename T>
+	inline std::string generate_insert_values_sql(MYSQL* con, const T*& first, const T* last,
+		size_t max_rows = SIZE_MAX, size_t max_size = SIZE_MAX) {
+		std::string sql(fixed_sql_of<T>::insert_prefix.view());
+
+		size_t rows = 0;
+		for (; first != last && rows < max_rows; ++first, ++rows) {
+			if (rows > 0) {
+				if (sql.size() >= max_size) {
+					break;
+				}
+				sql += ',';
+			}
+			append_sql_row(sql, con, *first);
+		}
+		sql += ';';
+		return sql;
+	}
+
+	//把文本协议中的一列写入value，data为nullptr表示NULL
+	template<typename U>
+	inline void set_text_value(U& value, const char* data, unsigned long len) {
+		if constexpr (is_optional_v<U>) {
+			if (data == nullptr) {
+				value.reset();
+			}
+			else {
+				set_text_value(value.emplace(), data, len);
+			}
+		}
+		else if constexpr (std::is_same_v<bool, U>) {
+			value = data != nullptr && len > 0 && data[0] != '0';
+		}
+		else if constexpr (std::is_arithmetic_v<U>) {
+			value = U{};
+			if (data != nullptr) {
+				std::from_chars(data, data + len, value);
+			}
+		}
+		else {
+			size_t n = data == nullptr ? 0 : len;
+			if constexpr (std::is_same_v<std::string, U>) {
+				value.assign(data == nullptr ? "" : data, n);
+			}
+			else if constexpr (std::is_same_v<blob, U>) {
+				value.assign(data, data + n);
+			}
+			else if constexpr (is_char_array_v<U> or is_char_std_array_v<U>) { //放不下的部分截断，剩余部分补0
+				char* dst = (char*)&value;
+				n = (std::min)(n, sizeof(U));
+				if (n > 0) {
+					memcpy(dst, data, n);
+				}
+				memset(dst + n, 0, sizeof(U) - n);
+			}
+			else {
+				static_assert(sizeof(U) == 0, "type is not supported by query");
+			}
+		}
+	}
+
+	//列数必须和T的字段数一致
+	template<typename T>
+	inline void read_text_row(T& t, MYSQL_ROW row, const unsigned long* lengths) {
+		size_t index = 0;
+		for_each_value(t, [&](auto&& value) {
+			set_text_value(value, row[index], lengths[index]);
+			index++;
+		});
+	}
+}
+
+#endif //TEXT_PROTOCOL_H
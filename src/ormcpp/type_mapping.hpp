@@ -13,7 +13,7 @@ namespace manjusaka {
     template<typename T>
     struct identity {};
 
-//C++͵mysqlͱǩӳ
+//C++类型到mysql参数类型标签的映射
 #define REGISTER_TYPE(Type, Index)                                           \
   inline constexpr int type_to_id(identity<Type>) noexcept { return Index; } \
   inline constexpr auto id_to_type(                                          \
@@ -45,11 +45,11 @@ inline std::string id_to_type(
 #define BIGINT int64_t
 #define BLOB std::vector<char>
 #define TEXT std::string
-#define VARCHAR(size) std::array<char, size>  //TODO:Ժ滻Զ建
+#define VARCHAR(size) std::array<char, size>  //TODO:以后替换成自定义缓冲区类
 
     using blob = std::vector<char>;
 
-    //͵SQL͵ӳ
+    //类型到SQL类型的映射
     inline constexpr std::string_view type_to_name(identity<char>) noexcept {
         return "TINYINT";
     }